@@ -0,0 +1,67 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_ASYNC_H
+#define MODBUS_ASYNC_H
+
+/* Non-blocking client driving many TCP links from one thread with epoll.
+ * Linux only. Requests are built with the modbus_xxx_gen functions and
+ * responses are handed to modbus_ADU_parser, whatever the framing on the link.
+ */
+
+#include <stdint.h>
+
+#include "modbus.h"
+
+#ifdef  __cplusplus
+    extern "C" {
+#endif
+
+/* Framing used on a link */
+#define MODBUS_ASYNC_RTU_OVER_TCP  0  // RTU ADU, CRC included, as is on the socket
+#define MODBUS_ASYNC_TCP           1  // MBAP header followed by the PDU
+
+/* Modbus_Messaging_Implementation_Guide_V1_0b.pdf (chapter 3 section 1 page 5)
+ * MBAP header: transaction id(2), protocol id(2), length(2), unit id(1)
+ */
+#define MODBUS_TCP_HEADER_LENGTH         7
+#define MODBUS_TCP_DEFAULT_PORT          502
+
+#define MODBUS_ASYNC_DEFAULT_TIMEOUT_MS  1000
+#define MODBUS_ASYNC_BACKOFF_MIN_MS      100
+#define MODBUS_ASYNC_BACKOFF_MAX_MS      30000
+
+typedef struct modbus_async_t modbus_async_t;
+typedef struct modbus_async_conn_t modbus_async_conn_t;
+
+/* Called once per submitted request.
+ * rc: what modbus_ADU_parser returned (0, -1 or the exception code), or -1
+ *     if no response came, with errno ETIMEDOUT or the error that dropped
+ *     the link (ECONNRESET, ECONNREFUSED...), or EMBBADDATA if a MBAP frame
+ *     does not hold a whole response.
+ * frame: the frame given to modbus_async_submit, parsed if rc >= 0
+ */
+typedef void (*modbus_async_cb_t)(modbus_async_conn_t *conn, int rc,
+                                  modbus_res_frame_t *frame, void *user);
+
+modbus_async_t *modbus_async_new(int max_conns);
+void modbus_async_free(modbus_async_t *ctx);
+
+modbus_async_conn_t *modbus_async_connect(modbus_async_t *ctx, const char *ip, uint16_t port, int framing);
+modbus_async_conn_t *modbus_async_listen(modbus_async_t *ctx, const char *ip, uint16_t port, int framing,
+                                         modbus_mapping_t *map);
+void modbus_async_close(modbus_async_conn_t *conn);
+void modbus_async_set_timeout(modbus_async_conn_t *conn, uint32_t timeout_ms);
+int modbus_async_is_connected(const modbus_async_conn_t *conn);
+uint16_t modbus_async_port(const modbus_async_conn_t *conn);
+
+int modbus_async_submit(modbus_async_conn_t *conn, const uint8_t ADU[], int len,
+                        modbus_res_frame_t *frame, modbus_async_cb_t cb, void *user);
+int modbus_async_run(modbus_async_t *ctx, int timeout_ms);
+
+#ifdef  __cplusplus
+    }
+#endif
+
+#endif  /* MODBUS_ASYNC_H */
@@ -0,0 +1,53 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_CHANGE_H
+#define MODBUS_CHANGE_H
+
+/* Change detection on parsed responses. The last published values of every
+ * (unit, table, range) are kept, so that only what moved is passed on.
+ * The table is the function code that read it (MODBUS_FC_READ_xxx).
+ */
+
+#include <stdint.h>
+
+#include "modbus.h"
+#include "modbus-tag.h"
+
+#ifdef  __cplusplus
+    extern "C" {
+#endif
+
+#define MODBUS_DEADBAND_ABSOLUTE  0  // changed if |new - old| > band
+#define MODBUS_DEADBAND_PERCENT   1  // changed if |new - old| > band% of |old|
+
+/* A value of a register range that is only republished once it moved by
+ * more than the band. Registers without a deadband are republished on any
+ * change.
+ */
+typedef struct modbus_deadband_t {
+    uint16_t addr;            // first register of the value
+    uint8_t  type;            // modbus_tag_type_t
+    uint8_t  order;           // modbus_byte_order_t
+    uint8_t  mode;            // MODBUS_DEADBAND_ABSOLUTE or MODBUS_DEADBAND_PERCENT
+    double   band;
+} modbus_deadband_t;
+
+typedef struct modbus_change_t modbus_change_t;
+
+modbus_change_t *modbus_change_new(int max_ranges);
+void modbus_change_free(modbus_change_t *ctx);
+void modbus_change_reset(modbus_change_t *ctx);
+
+int modbus_change_set_deadbands(modbus_change_t *ctx, uint8_t unit, uint8_t fn_code,
+                                uint16_t addr, uint16_t nb,
+                                const modbus_deadband_t deadbands[], int nb_deadbands);
+int modbus_change_detect(modbus_change_t *ctx, const modbus_res_frame_t *frame,
+                         uint16_t addr, uint16_t changed[]);
+
+#ifdef  __cplusplus
+    }
+#endif
+
+#endif  /* MODBUS_CHANGE_H */
@@ -0,0 +1,54 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_CONFIG_H
+#define MODBUS_CONFIG_H
+
+/* Build-time feature selection. Everything is in by default; a small
+ * footprint build turns off what the product does not use on the compiler
+ * command line, e.g. a master that only polls registers:
+ *
+ *   cc -Os -DMODBUS_DEBUG=0 -DMODBUS_WITH_ERROR_STRINGS=0 \
+ *      -DMODBUS_WITH_READ_BITS=0 -DMODBUS_WITH_WRITE=0 -DMODBUS_WITH_SLAVE=0 ...
+ *
+ * Functions of a feature that is off are not declared nor built, so using
+ * one fails at compile time. Backends (scheduler, async TCP, process
+ * image, series store...) are selected by the sources that are linked in,
+ * each only needs src/modbus.c. tools/size-report.sh prints the code and
+ * data size of the usual profiles.
+ */
+
+/* Diagnostics printed with fprintf on stderr */
+#ifndef MODBUS_DEBUG
+#define MODBUS_DEBUG 1
+#endif
+
+/* Messages of modbus_strerror(). When off it only tells Modbus exceptions
+ * from other errors, and defers to strerror() for system ones.
+ */
+#ifndef MODBUS_WITH_ERROR_STRINGS
+#define MODBUS_WITH_ERROR_STRINGS 1
+#endif
+
+/* Function codes: requests generated and responses decoded. Responses with
+ * a code left out fail to parse with errno EMBUNKFUN.
+ */
+#ifndef MODBUS_WITH_READ_BITS
+#define MODBUS_WITH_READ_BITS 1             // 0x01, 0x02
+#endif
+
+#ifndef MODBUS_WITH_READ_REGISTERS
+#define MODBUS_WITH_READ_REGISTERS 1        // 0x03, 0x04
+#endif
+
+#ifndef MODBUS_WITH_WRITE
+#define MODBUS_WITH_WRITE 1                 // 0x05, 0x06, 0x0F, 0x10
+#endif
+
+/* Slave side: modbus_reply_gen() and the stand-in slave of modbus-async */
+#ifndef MODBUS_WITH_SLAVE
+#define MODBUS_WITH_SLAVE 1
+#endif
+
+#endif  /* MODBUS_CONFIG_H */
@@ -0,0 +1,64 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_IMAGE_H
+#define MODBUS_IMAGE_H
+
+/* Process image in POSIX shared memory. One poller process writes what
+ * modbus_ADU_parser decoded, any number of processes read it, without
+ * locks nor syscalls once mapped.
+ *
+ * The image is a list of regions, each a range of one table of one unit.
+ * The table is the function code that reads it (MODBUS_FC_READ_xxx), bits
+ * are stored as 0/1 registers. Regions are cut in blocks of
+ * MODBUS_IMAGE_BLOCK_REGS registers, one cache line each, guarded by a
+ * sequence counter: readers retry a block the writer was changing under
+ * them, the writer never waits.
+ */
+
+#include <stdint.h>
+
+#include "modbus.h"
+
+#ifdef  __cplusplus
+    extern "C" {
+#endif
+
+#define MODBUS_IMAGE_BLOCK_REGS  28
+
+/* Attempts at reading a block before giving up on a writer that stopped
+ * in the middle of it. A block write takes well under a microsecond.
+ */
+#ifndef MODBUS_IMAGE_READ_RETRIES
+#define MODBUS_IMAGE_READ_RETRIES  100000
+#endif
+
+typedef struct modbus_image_t modbus_image_t;
+
+typedef struct modbus_image_region_t {
+    uint8_t  unit;
+    uint8_t  fn_code;         // table, MODBUS_FC_READ_xxx
+    uint16_t addr;            // first register of the region
+    uint16_t nb;              // number of registers of the region
+} modbus_image_region_t;
+
+modbus_image_t *modbus_image_create(const char *name, const modbus_image_region_t regions[], int nb_regions);
+modbus_image_t *modbus_image_open(const char *name);
+void modbus_image_close(modbus_image_t *img);
+int modbus_image_unlink(const char *name);
+
+int modbus_image_lookup(const modbus_image_t *img, uint8_t unit, uint8_t fn_code, uint16_t addr);
+int modbus_image_read_index(const modbus_image_t *img, int index, int nb, uint16_t dest[]);
+int modbus_image_read(const modbus_image_t *img, uint8_t unit, uint8_t fn_code, uint16_t addr,
+                      int nb, uint16_t dest[]);
+
+int modbus_image_write(modbus_image_t *img, uint8_t unit, uint8_t fn_code, uint16_t addr,
+                       int nb, const uint16_t src[]);
+int modbus_image_write_frame(modbus_image_t *img, const modbus_res_frame_t *frame, uint16_t addr);
+
+#ifdef  __cplusplus
+    }
+#endif
+
+#endif  /* MODBUS_IMAGE_H */
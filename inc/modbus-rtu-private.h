@@ -15,6 +15,8 @@
 
 #define _MODBUS_RTU_CHECKSUM_LENGTH    2
 
+uint16_t _calc_CRC(uint8_t buf[], uint8_t len);
+int _CRC_concatenate(uint8_t buf[], uint8_t len);
 
 
 #endif /* MODBUS_RTU_PRIVATE_H */
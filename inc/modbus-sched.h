@@ -0,0 +1,90 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_SCHED_H
+#define MODBUS_SCHED_H
+
+#include <stdint.h>
+
+#include "modbus.h"
+
+#ifdef  __cplusplus
+    extern "C" {
+#endif
+
+/* Modbus_over_serial_line_V1_02.pdf (chapter 2 section 5 page 13)
+ * A frame is preceded and followed by a silent interval of at least 3.5
+ * character times. Above 19200 bps a fixed 1.750 ms is recommended.
+ */
+#define MODBUS_RTU_T35_FIXED_US          1750
+#define MODBUS_RTU_T35_FIXED_BAUD        19200
+
+/* Every RTU character is start(1) + data(8) + parity(1) + stop(1), or
+ * start(1) + data(8) + stop(2) when no parity is used: 11 bits either way.
+ * 8N1 lines, which are out of spec but common, use 10 bits.
+ */
+#define MODBUS_RTU_BITS_PER_CHAR         11
+
+/* Highest unicast slave address on a serial line */
+#define MODBUS_MAX_SLAVE_ADDRESS         247
+
+/* Bounds of the per-slave exponential back off after timeouts */
+#define MODBUS_SCHED_BACKOFF_MIN_US      100000
+#define MODBUS_SCHED_BACKOFF_MAX_US      30000000
+
+/* Response timeout used until a slave latency has been measured */
+#define MODBUS_SCHED_DEFAULT_LATENCY_US  50000
+
+// A periodic read request on the line
+typedef struct modbus_poll_job_t {
+    uint8_t  unit;
+    uint8_t  fn_code;         // one of the MODBUS_FC_READ_xxx
+    uint16_t addr;
+    uint8_t  nb;
+    uint8_t  priority;        // tie break between equal deadlines, 0 is most urgent
+    uint32_t period_us;
+    uint64_t release_us;      // start of the current period
+    uint64_t deadline_us;     // end of the current period
+    uint32_t misses;          // periods that ended before the job got the bus
+} modbus_poll_job_t;
+
+// What the scheduler learned about one slave
+typedef struct modbus_slave_stat_t {
+    uint32_t latency_us;      // smoothed turnaround, 0 if never answered
+    uint32_t backoff_us;      // current back off, 0 if the slave is healthy
+    uint64_t backoff_until_us;
+    uint16_t timeouts;        // consecutive timeouts
+} modbus_slave_stat_t;
+
+typedef struct modbus_sched_t {
+    uint32_t baud;
+    uint32_t char_ns;         // time on the wire of a single character
+    uint32_t t35_us;          // inter-frame silent interval
+    modbus_poll_job_t *jobs;  // storage given by the caller
+    int nb_jobs;
+    int max_jobs;
+    int in_flight;            // index of the job waiting for a response, -1 if idle
+    uint64_t tx_us;           // when the in flight request was put on the wire
+    uint64_t bus_free_us;     // earliest time the next request may start
+    modbus_slave_stat_t slaves[MODBUS_MAX_SLAVE_ADDRESS + 1];
+} modbus_sched_t;
+
+int modbus_sched_init(modbus_sched_t *sched, uint32_t baud, uint8_t bits_per_char,
+                      modbus_poll_job_t jobs[], int max_jobs);
+int modbus_sched_add(modbus_sched_t *sched, uint8_t unit, uint8_t fn_code, uint16_t addr,
+                     uint8_t nb, uint32_t period_us, uint8_t priority, uint64_t now_us);
+uint32_t modbus_sched_wire_us(const modbus_sched_t *sched, int len);
+int modbus_sched_rsp_len(const modbus_poll_job_t *job);
+uint32_t modbus_sched_timeout_us(const modbus_sched_t *sched, int job);
+
+int modbus_sched_next(modbus_sched_t *sched, uint64_t now_us, uint8_t ADU[], uint64_t *tx_us);
+void modbus_sched_sent(modbus_sched_t *sched, int job, uint64_t tx_us);
+void modbus_sched_done(modbus_sched_t *sched, int job, uint64_t rx_us);
+void modbus_sched_timeout(modbus_sched_t *sched, int job, uint64_t now_us);
+
+#ifdef  __cplusplus
+    }
+#endif
+
+#endif  /* MODBUS_SCHED_H */
@@ -0,0 +1,69 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_SERIES_H
+#define MODBUS_SERIES_H
+
+/* Append-only store of register values over time, one compressed column
+ * per (unit, table, address). The table is the function code that read it
+ * (MODBUS_FC_READ_xxx).
+ *
+ * Samples are grouped in blocks of MODBUS_SERIES_BLOCK_SAMPLES. In a block
+ * timestamps are stored as delta-of-delta and values as deltas, both
+ * zigzag encoded into variable width bit fields: a steady 1 s poll of a
+ * value that does not move costs 2 bits per sample. Each block keeps its
+ * time span and value range, so scans skip blocks that cannot match.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "modbus.h"
+
+#ifdef  __cplusplus
+    extern "C" {
+#endif
+
+#define MODBUS_SERIES_BLOCK_SAMPLES  1024
+
+typedef struct modbus_series_store_t modbus_series_store_t;
+
+/* Streaming reader of one series. Fields are private. It stays valid while
+ * samples are appended, and picks them up once it reached the end. It does
+ * not survive modbus_series_trim().
+ */
+typedef struct modbus_series_reader_t {
+    const void *series;
+    int block;
+    uint32_t bitpos;
+    uint32_t index;           // samples read in the current block
+    uint64_t t_ms;
+    int64_t delta;
+    uint16_t value;
+    uint64_t from_ms;
+    uint64_t to_ms;
+    uint16_t lo;
+    uint16_t hi;
+} modbus_series_reader_t;
+
+modbus_series_store_t *modbus_series_new(int max_series);
+void modbus_series_free(modbus_series_store_t *store);
+
+int modbus_series_append(modbus_series_store_t *store, uint8_t unit, uint8_t fn_code,
+                         uint16_t addr, uint64_t t_ms, uint16_t value);
+int modbus_series_append_frame(modbus_series_store_t *store, const modbus_res_frame_t *frame,
+                               uint16_t addr, uint64_t t_ms);
+void modbus_series_trim(modbus_series_store_t *store, uint64_t before_ms);
+size_t modbus_series_memory(const modbus_series_store_t *store);
+
+int modbus_series_scan(const modbus_series_store_t *store, uint8_t unit, uint8_t fn_code, uint16_t addr,
+                       uint64_t from_ms, uint64_t to_ms, uint16_t lo, uint16_t hi,
+                       modbus_series_reader_t *reader);
+int modbus_series_next(modbus_series_reader_t *reader, uint64_t *t_ms, uint16_t *value);
+
+#ifdef  __cplusplus
+    }
+#endif
+
+#endif  /* MODBUS_SERIES_H */
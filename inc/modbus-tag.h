@@ -0,0 +1,77 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_TAG_H
+#define MODBUS_TAG_H
+
+/* Typed tags over register blocks. A schema (list of tags) is compiled once
+ * into a decode plan, which then turns the registers of every response
+ * into engineering values in one pass: either an array of doubles, or the
+ * fields of a caller struct in their native types.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "modbus.h"
+
+#ifdef  __cplusplus
+    extern "C" {
+#endif
+
+/* Value types, each spans 1, 2 or 4 registers */
+typedef enum {
+    MODBUS_TAG_INT16 = 0,
+    MODBUS_TAG_UINT16,
+    MODBUS_TAG_INT32,
+    MODBUS_TAG_UINT32,
+    MODBUS_TAG_INT64,
+    MODBUS_TAG_FLOAT32,
+    MODBUS_TAG_FLOAT64,
+    MODBUS_TAG_TYPE_MAX
+} modbus_tag_type_t;
+
+typedef struct modbus_tag_t {
+    uint16_t addr;            // first register of the value
+    uint8_t  type;            // modbus_tag_type_t
+    uint8_t  order;           // modbus_byte_order_t
+    double   scale;           // value = raw * scale + offset
+    double   offset;
+    uint16_t field;           // offsetof() the value in the struct of modbus_decode_plan_run_struct()
+} modbus_tag_t;
+
+// One tag of a compiled plan
+typedef struct modbus_decode_op_t {
+    uint32_t src[8];          // offset in the register block of each byte, most significant first
+    uint16_t dest;            // index of the value in the output
+    uint16_t field;           // byte offset of the value in the output struct
+    uint8_t  width;           // bytes written at field: size of the type, of a double if scaled
+    uint8_t  scaled;          // scale or offset is applied, the field is a double
+    double   scale;
+    double   offset;
+} modbus_decode_op_t;
+
+typedef struct modbus_decode_plan_t {
+    uint16_t addr;            // first register read by the plan
+    uint32_t nb;              // number of registers read by the plan
+    int nb_ops;
+    uint32_t struct_size;     // bytes of output struct written, up to the end of the last field
+    modbus_decode_op_t *ops;  // storage given by the caller, grouped by type
+    int group_end[MODBUS_TAG_TYPE_MAX];  // ops of type t are [group_end[t-1], group_end[t])
+    int native_end[MODBUS_TAG_TYPE_MAX]; // the unscaled ones first, up to native_end[t]
+} modbus_decode_plan_t;
+
+int modbus_tag_nb_registers(uint8_t type);
+int modbus_decode_plan_compile(modbus_decode_plan_t *plan, const modbus_tag_t tags[], int nb_tags,
+                               modbus_decode_op_t ops[]);
+int modbus_decode_plan_run(const modbus_decode_plan_t *plan, const uint16_t regs[],
+                           uint16_t addr, int nb, double values[]);
+int modbus_decode_plan_run_struct(const modbus_decode_plan_t *plan, const uint16_t regs[],
+                                  uint16_t addr, int nb, void *out, size_t size);
+
+#ifdef  __cplusplus
+    }
+#endif
+
+#endif  /* MODBUS_TAG_H */
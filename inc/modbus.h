@@ -7,10 +7,10 @@
 #ifndef MODBUS_H
 #define MODBUS_H
 
-#define MODBUS_DEBUG 1
-
 #include <stdint.h>
 
+#include "modbus-config.h"
+
 #ifdef  __cplusplus
     extern "C" {
 #endif
@@ -122,6 +122,7 @@ enum {
 #define EMBUNKEXC  (EMBXGTAR + 4)
 #define EMBMDATA   (EMBXGTAR + 5)
 #define EMBBADSLAVE (EMBXGTAR + 6)
+#define EMBUNKFUN  (EMBXGTAR + 7)
 
 extern const unsigned int libmodbus_version_major;
 extern const unsigned int libmodbus_version_minor;
@@ -174,17 +175,30 @@ const char *modbus_strerror(int errnum);
 
 // Functions for payload generation -----------------------------
 
+#if MODBUS_WITH_READ_BITS
 int modbus_read_bits_gen(uint8_t unit, uint16_t addr, uint8_t nb, uint8_t ADU[]);
 int modbus_read_input_bits_gen(uint8_t unit, uint16_t addr, uint8_t nb, uint8_t ADU[]);
+#endif
+#if MODBUS_WITH_READ_REGISTERS
 int modbus_read_registers_gen(uint8_t unit, uint16_t addr, uint8_t nb, uint8_t ADU[]);
 int modbus_read_input_registers_gen(uint8_t unit, uint16_t addr, uint8_t nb, uint8_t ADU[]);
+#endif
+#if MODBUS_WITH_WRITE
 int modbus_write_bit_gen(uint8_t unit, uint16_t addr, int status, uint8_t ADU[]);
 int modbus_write_register_gen(uint8_t unit, uint16_t addr, const uint16_t value, uint8_t ADU[]);
 int modbus_write_bits_gen(uint8_t unit, uint16_t addr, uint8_t nb, const uint8_t data[], uint8_t ADU[]);
 int modbus_write_registers_gen(uint8_t unit, uint16_t addr, uint8_t nb, const uint16_t data[], uint8_t ADU[]);
+#endif
 
 // Function to parse the payload received
 int modbus_ADU_parser(modbus_res_frame_t *frame);
+int modbus_ADU_length(const uint8_t ADU[], int len);
+
+#if MODBUS_WITH_SLAVE
+// Functions to answer a request, as a slave would
+int modbus_request_length(const uint8_t req[], int len);
+int modbus_reply_gen(const uint8_t req[], int req_len, modbus_mapping_t *map, uint8_t rsp[]);
+#endif
 
 /* From libmodbus
 int modbus_read_bits(modbus_t *ctx, int addr, int nb, uint8_t *dest);
@@ -258,6 +272,20 @@ int modbus_reply_exception(modbus_t *ctx, const uint8_t *req,
         ((int16_t*)(tab_int16))[(index) + 3] = (int16_t)(value); \
     } while (0)
 
+/* Byte orders, named after the order of the bytes on the wire for a value
+ * whose most significant byte is A, as modbus_get_float_abcd and friends.
+ * 64-bit values extend the pattern: ABCD is ABCDEFGH, DCBA is HGFEDCBA,
+ * BADC is BADCFEHG and CDAB is GHEFCDAB. Single registers only honour the
+ * byte swap: ABCD and CDAB read AB, DCBA and BADC read BA.
+ */
+typedef enum {
+    MODBUS_ORDER_ABCD = 0,
+    MODBUS_ORDER_DCBA,
+    MODBUS_ORDER_BADC,
+    MODBUS_ORDER_CDAB,
+    MODBUS_ORDER_MAX
+} modbus_byte_order_t;
+
 void modbus_set_bits_from_byte(uint8_t *dest, int idx, const uint8_t value);
 void modbus_set_bits_from_bytes(uint8_t *dest, int idx, unsigned int nb_bits,
                                        const uint8_t *tab_byte);
@@ -274,6 +302,29 @@ void modbus_set_float_dcba(float f, uint16_t *dest);
 void modbus_set_float_badc(float f, uint16_t *dest);
 void modbus_set_float_cdab(float f, uint16_t *dest);
 
+int32_t modbus_get_int32(const uint16_t *src, modbus_byte_order_t order);
+uint32_t modbus_get_uint32(const uint16_t *src, modbus_byte_order_t order);
+int64_t modbus_get_int64(const uint16_t *src, modbus_byte_order_t order);
+double modbus_get_double(const uint16_t *src, modbus_byte_order_t order);
+
+void modbus_set_int32(int32_t value, uint16_t *dest, modbus_byte_order_t order);
+void modbus_set_uint32(uint32_t value, uint16_t *dest, modbus_byte_order_t order);
+void modbus_set_int64(int64_t value, uint16_t *dest, modbus_byte_order_t order);
+void modbus_set_double(double value, uint16_t *dest, modbus_byte_order_t order);
+
+// Whole register blocks: nb values, 2 registers each (4 for 64-bit types)
+int modbus_get_float_array(const uint16_t *src, float *dest, int nb, modbus_byte_order_t order);
+int modbus_get_int32_array(const uint16_t *src, int32_t *dest, int nb, modbus_byte_order_t order);
+int modbus_get_uint32_array(const uint16_t *src, uint32_t *dest, int nb, modbus_byte_order_t order);
+int modbus_get_int64_array(const uint16_t *src, int64_t *dest, int nb, modbus_byte_order_t order);
+int modbus_get_double_array(const uint16_t *src, double *dest, int nb, modbus_byte_order_t order);
+
+int modbus_set_float_array(const float *src, uint16_t *dest, int nb, modbus_byte_order_t order);
+int modbus_set_int32_array(const int32_t *src, uint16_t *dest, int nb, modbus_byte_order_t order);
+int modbus_set_uint32_array(const uint32_t *src, uint16_t *dest, int nb, modbus_byte_order_t order);
+int modbus_set_int64_array(const int64_t *src, uint16_t *dest, int nb, modbus_byte_order_t order);
+int modbus_set_double_array(const double *src, uint16_t *dest, int nb, modbus_byte_order_t order);
+
 
 #ifdef  __cplusplus
     }
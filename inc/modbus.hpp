@@ -0,0 +1,173 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_HPP
+#define MODBUS_HPP
+
+/* C++20 compile-time frame builder. Requests known at build time are
+ * computed entirely by the compiler, CRC included, and limits such as
+ * MODBUS_MAX_READ_REGISTERS are checked by static_assert instead of at run
+ * time. Frames are std::array whose size is the ADU length:
+ *
+ *   static constexpr auto poll = modbus::read_registers<0x01, 0x0100, 10>();
+ *   write(fd, poll.data(), poll.size());
+ *
+ * The frames are byte for byte those of the modbus_xxx_gen functions.
+ */
+
+#if __cplusplus < 202002L
+#error "modbus.hpp needs C++20"
+#endif
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "modbus.h"
+
+namespace modbus {
+
+/** CRC-16/modbus of len bytes of buf, as _calc_CRC
+ * @return CRC-16/modbus: CRC-Hi = return >> 8, CRC-Lo = return & 0x00FF
+ */
+constexpr uint16_t crc16(const uint8_t *buf, std::size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (std::size_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int j = 0; j < 8; j++)
+            crc = (crc & 0x0001) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc;
+}
+
+/* Length of the normal responses, so receive buffers can be sized too:
+ * unit(1), fn_code(1), byte_cnt(1), bytes(N), crc(2)
+ */
+template <uint16_t Nb>
+inline constexpr std::size_t read_bits_response_length = 5 + (Nb + 7) / 8;
+template <uint16_t Nb>
+inline constexpr std::size_t read_registers_response_length = 5 + Nb * 2;
+// unit(1), fn_code(1), start addr(2), quantity or value(2), crc(2)
+inline constexpr std::size_t write_response_length = 8;
+
+namespace detail {
+
+// Same as _MODBUS_RTU_PRESET_REQ_LENGTH and _MODBUS_RTU_CHECKSUM_LENGTH
+inline constexpr std::size_t preset_req_length = 6;
+inline constexpr std::size_t checksum_length = 2;
+inline constexpr std::size_t preset_length = preset_req_length + checksum_length;
+
+template <std::size_t N>
+constexpr std::array<uint8_t, N> request_basis(uint8_t unit, uint8_t function, uint16_t addr, uint16_t nb)
+{
+    std::array<uint8_t, N> adu{};
+    adu[0] = unit;
+    adu[1] = function;
+    adu[2] = addr >> 8;
+    adu[3] = addr & 0x00FF;
+    adu[4] = nb >> 8;
+    adu[5] = nb & 0x00FF;
+    return adu;
+}
+
+// Fills the last 2 bytes with (CRC_L, CRC_H)
+template <std::size_t N>
+constexpr std::array<uint8_t, N> crc_concatenate(std::array<uint8_t, N> adu)
+{
+    uint16_t crc = crc16(adu.data(), N - checksum_length);
+    adu[N - 2] = crc & 0x00FF;
+    adu[N - 1] = crc >> 8;
+    return adu;
+}
+
+} // namespace detail
+
+template <uint8_t Unit, uint16_t Addr, uint16_t Nb>
+constexpr std::array<uint8_t, detail::preset_length> read_bits()
+{
+    static_assert(Nb >= 1 && Nb <= MODBUS_MAX_READ_BITS, "Too many bits requested");
+    return detail::crc_concatenate(
+        detail::request_basis<detail::preset_length>(Unit, MODBUS_FC_READ_COILS, Addr, Nb));
+}
+
+template <uint8_t Unit, uint16_t Addr, uint16_t Nb>
+constexpr std::array<uint8_t, detail::preset_length> read_input_bits()
+{
+    static_assert(Nb >= 1 && Nb <= MODBUS_MAX_READ_BITS, "Too many bits requested");
+    return detail::crc_concatenate(
+        detail::request_basis<detail::preset_length>(Unit, MODBUS_FC_READ_DISCRETE_INPUTS, Addr, Nb));
+}
+
+template <uint8_t Unit, uint16_t Addr, uint16_t Nb>
+constexpr std::array<uint8_t, detail::preset_length> read_registers()
+{
+    static_assert(Nb >= 1 && Nb <= MODBUS_MAX_READ_REGISTERS, "Too many registers requested");
+    return detail::crc_concatenate(
+        detail::request_basis<detail::preset_length>(Unit, MODBUS_FC_READ_HOLDING_REGISTERS, Addr, Nb));
+}
+
+template <uint8_t Unit, uint16_t Addr, uint16_t Nb>
+constexpr std::array<uint8_t, detail::preset_length> read_input_registers()
+{
+    static_assert(Nb >= 1 && Nb <= MODBUS_MAX_READ_REGISTERS, "Too many registers requested");
+    return detail::crc_concatenate(
+        detail::request_basis<detail::preset_length>(Unit, MODBUS_FC_READ_INPUT_REGISTERS, Addr, Nb));
+}
+
+template <uint8_t Unit, uint16_t Addr, bool Status>
+constexpr std::array<uint8_t, detail::preset_length> write_bit()
+{
+    return detail::crc_concatenate(
+        detail::request_basis<detail::preset_length>(Unit, MODBUS_FC_WRITE_SINGLE_COIL, Addr,
+                                                     Status ? 0xFF00 : 0x0000));
+}
+
+template <uint8_t Unit, uint16_t Addr, uint16_t Value>
+constexpr std::array<uint8_t, detail::preset_length> write_register()
+{
+    return detail::crc_concatenate(
+        detail::request_basis<detail::preset_length>(Unit, MODBUS_FC_WRITE_SINGLE_REGISTER, Addr, Value));
+}
+
+/* Bits to write are given as template arguments, first one at Addr */
+template <uint8_t Unit, uint16_t Addr, bool... Bits>
+constexpr auto write_bits()
+{
+    constexpr std::size_t nb = sizeof...(Bits);
+    constexpr std::size_t byte_count = (nb + 7) / 8;
+    static_assert(nb >= 1 && nb <= MODBUS_MAX_WRITE_BITS, "Writing too many bits");
+
+    constexpr bool bits[] = { Bits... };
+    auto adu = detail::request_basis<detail::preset_length + 1 + byte_count>(
+        Unit, MODBUS_FC_WRITE_MULTIPLE_COILS, Addr, nb);
+    adu[detail::preset_req_length] = byte_count;
+    for (std::size_t i = 0; i < nb; i++) {
+        if (bits[i])
+            adu[detail::preset_req_length + 1 + i / 8] |= 1 << (i % 8);
+    }
+    return detail::crc_concatenate(adu);
+}
+
+/* Words to write are given as template arguments, first one at Addr */
+template <uint8_t Unit, uint16_t Addr, uint16_t... Values>
+constexpr auto write_registers()
+{
+    constexpr std::size_t nb = sizeof...(Values);
+    static_assert(nb >= 1 && nb <= MODBUS_MAX_WRITE_REGISTERS, "Writing too many registers");
+
+    constexpr uint16_t values[] = { Values... };
+    auto adu = detail::request_basis<detail::preset_length + 1 + nb * 2>(
+        Unit, MODBUS_FC_WRITE_MULTIPLE_REGISTERS, Addr, nb);
+    adu[detail::preset_req_length] = nb * 2;
+    for (std::size_t i = 0; i < nb; i++) {
+        adu[detail::preset_req_length + 1 + i * 2] = values[i] >> 8;
+        adu[detail::preset_req_length + 2 + i * 2] = values[i] & 0x00FF;
+    }
+    return detail::crc_concatenate(adu);
+}
+
+} // namespace modbus
+
+#endif  /* MODBUS_HPP */
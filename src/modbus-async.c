@@ -0,0 +1,679 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Event loop for many concurrent links. Every link has at most one request
+ * in flight, which is what RTU gateways and most TCP slaves handle anyway.
+ * Timers are checked by scanning the links once per modbus_async_run(),
+ * cheap next to the syscalls for a few hundred links.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "modbus.h"
+#include "modbus-async.h"
+#include "modbus-rtu-private.h"
+
+#define _ASYNC_MAX_EVENTS  64
+
+typedef enum {
+  _CONN_FREE = 0,
+  _CONN_DOWN,         // client waiting to reconnect
+  _CONN_CONNECTING,
+  _CONN_UP,
+  _CONN_LISTEN,       // stand-in slave accepting links
+  _CONN_SERVER        // stand-in slave side of an accepted link
+} _conn_state_t;
+
+struct modbus_async_conn_t {
+  modbus_async_t *ctx;
+  _conn_state_t state;
+  int fd;
+  int framing;
+  uint32_t events;            // events registered to epoll, 0 if not registered
+  struct sockaddr_in addr;
+  uint32_t timeout_ms;
+  uint32_t backoff_ms;
+  uint64_t reconnect_ms;
+
+  // Request in flight
+  int pending;
+  uint8_t unit;
+  uint8_t fn_code;
+  uint16_t tid;               // MBAP transaction id
+  uint64_t deadline_ms;
+  modbus_res_frame_t *frame;
+  modbus_async_cb_t cb;
+  void *user;
+
+  uint8_t tx[MODBUS_MAX_ADU_LENGTH];
+  int tx_len;
+  int tx_sent;
+  uint8_t rx[MODBUS_MAX_ADU_LENGTH];
+  int rx_len;
+  uint8_t rtu[MODBUS_MAX_ADU_LENGTH];  // MBAP frames converted for the parser
+
+  modbus_mapping_t *map;      // stand-in slave tables
+};
+
+struct modbus_async_t {
+  int epfd;
+  int max_conns;
+  modbus_async_conn_t *conns;
+};
+
+static uint64_t _now_ms(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Converts a RTU ADU to a MBAP frame: the CRC is dropped, the unit moves
+ * to the header */
+static int _rtu_to_tcp(const uint8_t ADU[], int len, uint16_t tid, uint8_t tcp[]){
+  int pdu_len = len - 1 - _MODBUS_RTU_CHECKSUM_LENGTH;
+
+  tcp[0] = tid >> 8;
+  tcp[1] = tid & 0x00FF;
+  tcp[2] = 0;               // protocol id, 0 for Modbus
+  tcp[3] = 0;
+  tcp[4] = (pdu_len + 1) >> 8;
+  tcp[5] = (pdu_len + 1) & 0x00FF;
+  tcp[6] = ADU[0];
+  memcpy(&tcp[MODBUS_TCP_HEADER_LENGTH], &ADU[1], pdu_len);
+
+  return MODBUS_TCP_HEADER_LENGTH + pdu_len;
+}
+
+/* Converts a complete MBAP frame back to a RTU ADU, CRC included */
+static int _tcp_to_rtu(const uint8_t tcp[], uint8_t ADU[]){
+  int pdu_len = (tcp[4] << 8 | tcp[5]) - 1;
+
+  ADU[0] = tcp[6];
+  memcpy(&ADU[1], &tcp[MODBUS_TCP_HEADER_LENGTH], pdu_len);
+
+  return _CRC_concatenate(ADU, pdu_len + 1);
+}
+
+/* Length of the MBAP frame at the start of buf, 0 if incomplete, -1 if
+ * the header is not valid */
+static int _tcp_length(const uint8_t buf[], int len){
+  int mbap_len;
+
+  if (len < MODBUS_TCP_HEADER_LENGTH)
+    return 0;
+  mbap_len = buf[4] << 8 | buf[5];
+  if (buf[2] != 0 || buf[3] != 0 || mbap_len < 2 || mbap_len > MODBUS_MAX_PDU_LENGTH + 1)
+    return -1;
+
+  return MODBUS_TCP_HEADER_LENGTH - 1 + mbap_len;
+}
+
+static int _set_events(modbus_async_conn_t *conn, uint32_t events){
+  struct epoll_event ev;
+  int op;
+
+  if (events == conn->events)
+    return 0;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = conn;
+  op = conn->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(conn->ctx->epfd, op, conn->fd, &ev) == -1)
+    return -1;
+  conn->events = events;
+
+  return 0;
+}
+
+static void _complete(modbus_async_conn_t *conn, int rc, int err){
+  conn->pending = 0;
+  conn->tx_len = 0;
+  conn->tx_sent = 0;
+  conn->rx_len = 0;
+  errno = err;
+  if (conn->cb)
+    conn->cb(conn, rc, conn->frame, conn->user);
+}
+
+static void _close_fd(modbus_async_conn_t *conn){
+  if (conn->fd >= 0) {
+    // close() also removes the fd from the epoll set
+    close(conn->fd);
+    conn->fd = -1;
+  }
+  conn->events = 0;
+}
+
+/* Drops a client link and schedules the reconnection */
+static void _conn_fail(modbus_async_conn_t *conn, int err){
+  _close_fd(conn);
+
+  if (conn->state == _CONN_SERVER) {
+    conn->state = _CONN_FREE;
+    return;
+  }
+
+  if (MODBUS_DEBUG)
+    fprintf(stderr, "ERROR Link to %s:%d lost: %s, retry in %u ms\n",
+            inet_ntoa(conn->addr.sin_addr), ntohs(conn->addr.sin_port),
+            modbus_strerror(err), conn->backoff_ms);
+
+  conn->state = _CONN_DOWN;
+  conn->reconnect_ms = _now_ms() + conn->backoff_ms;
+  if (conn->backoff_ms < MODBUS_ASYNC_BACKOFF_MAX_MS / 2)
+    conn->backoff_ms *= 2;
+  else
+    conn->backoff_ms = MODBUS_ASYNC_BACKOFF_MAX_MS;
+
+  if (conn->pending)
+    _complete(conn, -1, err);
+}
+
+/* Sends what is left of the tx buffer */
+static int _flush(modbus_async_conn_t *conn){
+  while (conn->tx_sent < conn->tx_len) {
+    ssize_t n = send(conn->fd, &conn->tx[conn->tx_sent], conn->tx_len - conn->tx_sent, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      _conn_fail(conn, errno);
+      return -1;
+    }
+    conn->tx_sent += n;
+  }
+
+  if (_set_events(conn, EPOLLIN | EPOLLRDHUP |
+                  (conn->tx_sent < conn->tx_len ? EPOLLOUT : 0)) == -1) {
+    _conn_fail(conn, errno);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void _start_connect(modbus_async_conn_t *conn){
+  conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+  if (conn->fd == -1) {
+    _conn_fail(conn, errno);
+    return;
+  }
+  setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+
+  if (connect(conn->fd, (struct sockaddr *)&conn->addr, sizeof(conn->addr)) == -1 &&
+      errno != EINPROGRESS) {
+    _conn_fail(conn, errno);
+    return;
+  }
+  conn->state = _CONN_CONNECTING;
+  if (_set_events(conn, EPOLLOUT | EPOLLRDHUP) == -1)
+    _conn_fail(conn, errno);
+}
+
+static void _on_connected(modbus_async_conn_t *conn){
+  int err = 0;
+  socklen_t len = sizeof(err);
+
+  if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+    err = errno;
+  if (err) {
+    _conn_fail(conn, err);
+    return;
+  }
+  conn->state = _CONN_UP;
+  conn->backoff_ms = MODBUS_ASYNC_BACKOFF_MIN_MS;
+  conn->tx_sent = 0;
+  _flush(conn);
+}
+
+/* Handles whatever complete response sits in the rx buffer */
+static void _client_process(modbus_async_conn_t *conn){
+  modbus_res_frame_t *frame = conn->frame;
+  int len, rc;
+
+  if (conn->framing == MODBUS_ASYNC_TCP) {
+    while ((len = _tcp_length(conn->rx, conn->rx_len)) > 0 && len <= conn->rx_len) {
+      if ((conn->rx[0] << 8 | conn->rx[1]) == conn->tid)
+        break;
+      // Late answer to a request that timed out
+      memmove(conn->rx, &conn->rx[len], conn->rx_len - len);
+      conn->rx_len -= len;
+    }
+    if (len < 0) {
+      _conn_fail(conn, EMBBADDATA);
+      return;
+    }
+    if (len == 0 || len > conn->rx_len)
+      return;
+    // The CRC is made up here, so the MBAP length is the only check that
+    // the PDU came whole
+    len = _tcp_to_rtu(conn->rx, conn->rtu);
+    if (modbus_ADU_length(conn->rtu, len) != len) {
+      _complete(conn, -1, EMBBADDATA);
+      return;
+    }
+    frame->ADU = conn->rtu;
+  }
+  else {
+    len = modbus_ADU_length(conn->rx, conn->rx_len);
+    if (len < 0 || (len > 0 && (conn->rx[0] != conn->unit || (conn->rx[1] & 0x7F) != conn->fn_code))) {
+      // Garbage or late answer, drop it and wait for ours
+      conn->rx_len = 0;
+      return;
+    }
+    if (len == 0 || len > conn->rx_len)
+      return;
+    frame->ADU = conn->rx;
+  }
+
+  rc = modbus_ADU_parser(frame);
+  _complete(conn, rc, rc == -1 ? errno : 0);
+}
+
+#if MODBUS_WITH_SLAVE
+/* Stand-in slave: answers every complete request in the rx buffer */
+static void _server_process(modbus_async_conn_t *conn){
+  uint8_t rsp[MODBUS_MAX_ADU_LENGTH];
+
+  while (conn->tx_sent == conn->tx_len) {
+    const uint8_t *req;
+    int len, req_len, rsp_len;
+
+    if (conn->framing == MODBUS_ASYNC_TCP) {
+      len = _tcp_length(conn->rx, conn->rx_len);
+      if (len < 0) {
+        _conn_fail(conn, EMBBADDATA);
+        return;
+      }
+      if (len == 0 || len > conn->rx_len)
+        return;
+      req_len = _tcp_to_rtu(conn->rx, conn->rtu);
+      req = conn->rtu;
+    }
+    else {
+      len = modbus_request_length(conn->rx, conn->rx_len);
+      if (len == 0 || len > conn->rx_len)
+        return;
+      req_len = len;
+      req = conn->rx;
+    }
+
+    rsp_len = modbus_reply_gen(req, req_len, conn->map, rsp);
+    if (rsp_len > 0) {
+      if (conn->framing == MODBUS_ASYNC_TCP)
+        conn->tx_len = _rtu_to_tcp(rsp, rsp_len, conn->rx[0] << 8 | conn->rx[1], conn->tx);
+      else {
+        memcpy(conn->tx, rsp, rsp_len);
+        conn->tx_len = rsp_len;
+      }
+      conn->tx_sent = 0;
+    }
+    memmove(conn->rx, &conn->rx[len], conn->rx_len - len);
+    conn->rx_len -= len;
+
+    if (_flush(conn) == -1)
+      return;
+  }
+}
+#endif
+
+static void _on_readable(modbus_async_conn_t *conn){
+  for (;;) {
+    ssize_t n = recv(conn->fd, &conn->rx[conn->rx_len], sizeof(conn->rx) - conn->rx_len, 0);
+    if (n == 0) {
+      _conn_fail(conn, ECONNRESET);
+      return;
+    }
+    if (n == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        _conn_fail(conn, errno);
+      return;
+    }
+    conn->rx_len += n;
+
+    if (conn->state == _CONN_SERVER) {
+#if MODBUS_WITH_SLAVE
+      _server_process(conn);
+#endif
+    }
+    else if (conn->pending)
+      _client_process(conn);
+    else
+      conn->rx_len = 0;  // nobody asked for it
+
+    if (conn->fd < 0)
+      return;
+    if (conn->rx_len == (int)sizeof(conn->rx))
+      conn->rx_len = 0;  // no valid frame is that long
+  }
+}
+
+static void _on_accept(modbus_async_conn_t *listener){
+  modbus_async_t *ctx = listener->ctx;
+
+  for (;;) {
+    modbus_async_conn_t *conn = NULL;
+    int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (fd == -1)
+      return;
+    for (int i = 0; i < ctx->max_conns; i++) {
+      if (ctx->conns[i].state == _CONN_FREE) {
+        conn = &ctx->conns[i];
+        break;
+      }
+    }
+    if (conn == NULL) {
+      close(fd);
+      continue;
+    }
+    memset(conn, 0, sizeof(*conn));
+    conn->ctx     = ctx;
+    conn->state   = _CONN_SERVER;
+    conn->fd      = fd;
+    conn->framing = listener->framing;
+    conn->map     = listener->map;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    if (_set_events(conn, EPOLLIN | EPOLLRDHUP) == -1)
+      _conn_fail(conn, errno);
+  }
+}
+
+static modbus_async_conn_t *_conn_alloc(modbus_async_t *ctx, const char *ip, uint16_t port, int framing){
+  modbus_async_conn_t *conn = NULL;
+
+  if (framing != MODBUS_ASYNC_RTU_OVER_TCP && framing != MODBUS_ASYNC_TCP) {
+    errno = EINVAL;
+    return NULL;
+  }
+  for (int i = 0; i < ctx->max_conns; i++) {
+    if (ctx->conns[i].state == _CONN_FREE) {
+      conn = &ctx->conns[i];
+      break;
+    }
+  }
+  if (conn == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  memset(conn, 0, sizeof(*conn));
+  conn->ctx = ctx;
+  conn->fd = -1;
+  conn->framing = framing;
+  conn->timeout_ms = MODBUS_ASYNC_DEFAULT_TIMEOUT_MS;
+  conn->backoff_ms = MODBUS_ASYNC_BACKOFF_MIN_MS;
+  conn->addr.sin_family = AF_INET;
+  conn->addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, ip, &conn->addr.sin_addr) != 1) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return conn;
+}
+
+/** Create an event loop
+ * @param max_conns: Most links (client, listening and accepted) handled at once
+ *
+ * @param return: the loop, NULL with errno set on error
+*/
+modbus_async_t *modbus_async_new(int max_conns){
+  modbus_async_t *ctx;
+
+  if (max_conns <= 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  ctx = calloc(1, sizeof(*ctx));
+  if (ctx == NULL)
+    return NULL;
+  ctx->conns = calloc(max_conns, sizeof(*ctx->conns));
+  ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (ctx->conns == NULL || ctx->epfd == -1) {
+    free(ctx->conns);
+    free(ctx);
+    return NULL;
+  }
+  ctx->max_conns = max_conns;
+
+  return ctx;
+}
+
+/** Close every link and free the loop. Pending requests get no callback. */
+void modbus_async_free(modbus_async_t *ctx){
+  if (ctx == NULL)
+    return;
+  for (int i = 0; i < ctx->max_conns; i++) {
+    if (ctx->conns[i].state != _CONN_FREE)
+      _close_fd(&ctx->conns[i]);
+  }
+  close(ctx->epfd);
+  free(ctx->conns);
+  free(ctx);
+}
+
+/** Open a client link to a slave or gateway. The connection is made in the
+ * background and remade with exponential back off whenever it drops.
+ * @param ip: IPv4 address of the slave, dotted notation
+ * @param port: TCP port, usually MODBUS_TCP_DEFAULT_PORT
+ * @param framing: MODBUS_ASYNC_RTU_OVER_TCP or MODBUS_ASYNC_TCP
+ *
+ * @param return: the link, NULL with errno set on error
+*/
+modbus_async_conn_t *modbus_async_connect(modbus_async_t *ctx, const char *ip, uint16_t port, int framing){
+  modbus_async_conn_t *conn = _conn_alloc(ctx, ip, port, framing);
+
+  if (conn == NULL)
+    return NULL;
+  conn->state = _CONN_DOWN;
+  _start_connect(conn);
+
+  return conn;
+}
+
+/** Start a stand-in slave answering any link from the given tables, with
+ * modbus_reply_gen(). Meant for tests and load generation.
+ * @param ip: IPv4 address to listen on, dotted notation
+ * @param port: TCP port, 0 to let the system choose (see modbus_async_port)
+ * @param framing: MODBUS_ASYNC_RTU_OVER_TCP or MODBUS_ASYNC_TCP
+ * @param map: Tables of the slave, shared by all its links
+ *
+ * @param return: the listening link, NULL with errno set on error
+*/
+modbus_async_conn_t *modbus_async_listen(modbus_async_t *ctx, const char *ip, uint16_t port, int framing,
+                                         modbus_mapping_t *map){
+#if MODBUS_WITH_SLAVE
+  modbus_async_conn_t *conn = _conn_alloc(ctx, ip, port, framing);
+  socklen_t len = sizeof(conn->addr);
+
+  if (conn == NULL)
+    return NULL;
+  conn->map = map;
+  conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+  if (conn->fd == -1)
+    return NULL;
+  setsockopt(conn->fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+  if (bind(conn->fd, (struct sockaddr *)&conn->addr, sizeof(conn->addr)) == -1 ||
+      listen(conn->fd, SOMAXCONN) == -1 ||
+      getsockname(conn->fd, (struct sockaddr *)&conn->addr, &len) == -1) {
+    _close_fd(conn);
+    return NULL;
+  }
+  conn->state = _CONN_LISTEN;
+  if (_set_events(conn, EPOLLIN) == -1) {
+    _close_fd(conn);
+    conn->state = _CONN_FREE;
+    return NULL;
+  }
+
+  return conn;
+#else
+  (void)ctx; (void)ip; (void)port; (void)framing; (void)map;
+  errno = ENOTSUP;
+  return NULL;
+#endif
+}
+
+/** Close a link. Its pending request, if any, completes with ECANCELED. */
+void modbus_async_close(modbus_async_conn_t *conn){
+  _close_fd(conn);
+  if (conn->pending)
+    _complete(conn, -1, ECANCELED);
+  conn->state = _CONN_FREE;
+}
+
+/** Set the response timeout of a link, counted from modbus_async_submit() */
+void modbus_async_set_timeout(modbus_async_conn_t *conn, uint32_t timeout_ms){
+  conn->timeout_ms = timeout_ms;
+}
+
+int modbus_async_is_connected(const modbus_async_conn_t *conn){
+  return conn->state == _CONN_UP;
+}
+
+/** Local port of a listening link, remote port of a client link */
+uint16_t modbus_async_port(const modbus_async_conn_t *conn){
+  return ntohs(conn->addr.sin_port);
+}
+
+/** Queue a request on a link. It goes on the wire as soon as the link is up.
+ * @param ADU: RTU request built by one of the modbus_xxx_gen functions
+ * @param len: Length of ADU[]
+ * @param frame: Frame to parse the response into. data and num_reads are set
+ *               by the caller as for modbus_ADU_parser; frame->ADU points to
+ *               a buffer of the link that is only valid during the callback.
+ * @param cb: Called once with the outcome
+ *
+ * @param return: 0 if ok, -1 with errno EBUSY if a request is already in flight
+*/
+int modbus_async_submit(modbus_async_conn_t *conn, const uint8_t ADU[], int len,
+                        modbus_res_frame_t *frame, modbus_async_cb_t cb, void *user){
+  if (conn->pending) {
+    errno = EBUSY;
+    return -1;
+  }
+  // unit(1), PDU(1~253), crc(2)
+  if (len < 4 || len > MODBUS_MAX_PDU_LENGTH + 3) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  conn->pending = 1;
+  conn->unit = ADU[0];
+  conn->fn_code = ADU[1];
+  conn->frame = frame;
+  conn->cb = cb;
+  conn->user = user;
+  conn->deadline_ms = _now_ms() + conn->timeout_ms;
+  conn->rx_len = 0;
+  conn->tx_sent = 0;
+  if (conn->framing == MODBUS_ASYNC_TCP)
+    conn->tx_len = _rtu_to_tcp(ADU, len, ++conn->tid, conn->tx);
+  else {
+    memcpy(conn->tx, ADU, len);
+    conn->tx_len = len;
+  }
+
+  if (conn->state == _CONN_UP)
+    _flush(conn);
+
+  return 0;
+}
+
+/** Wait for I/O on all links, then fire due timeouts and reconnections
+ * @param timeout_ms: Longest wait, -1 to wait until something is due
+ *
+ * @param return: number of events handled, -1 with errno set on error
+*/
+int modbus_async_run(modbus_async_t *ctx, int timeout_ms){
+  struct epoll_event events[_ASYNC_MAX_EVENTS];
+  uint64_t now = _now_ms();
+  int wait = timeout_ms;
+  int n;
+
+  // Do not sleep past the next timer
+  for (int i = 0; i < ctx->max_conns; i++) {
+    modbus_async_conn_t *conn = &ctx->conns[i];
+    uint64_t due;
+
+    if (conn->state == _CONN_DOWN)
+      due = conn->reconnect_ms;
+    else if (conn->pending)
+      due = conn->deadline_ms;
+    else
+      continue;
+    if (conn->pending && conn->deadline_ms < due)
+      due = conn->deadline_ms;
+    due = due > now ? due - now : 0;
+    if (wait < 0 || due < (uint64_t)wait)
+      wait = (int)due;
+  }
+
+  n = epoll_wait(ctx->epfd, events, _ASYNC_MAX_EVENTS, wait);
+  if (n == -1) {
+    if (errno != EINTR)
+      return -1;
+    n = 0;
+  }
+
+  for (int i = 0; i < n; i++) {
+    modbus_async_conn_t *conn = events[i].data.ptr;
+    uint32_t ev = events[i].events;
+
+    if (conn->fd < 0)
+      continue;  // closed by an earlier event of this round
+    switch (conn->state) {
+      case _CONN_LISTEN:
+        _on_accept(conn);
+        break;
+      case _CONN_CONNECTING:
+        _on_connected(conn);
+        break;
+      case _CONN_UP:
+      case _CONN_SERVER:
+        if (ev & EPOLLIN)
+          _on_readable(conn);
+        if (conn->fd >= 0 && (ev & EPOLLOUT))
+          _flush(conn);
+        if (conn->fd >= 0 && (ev & (EPOLLERR | EPOLLHUP))) {
+          int err = 0;
+          socklen_t len = sizeof(err);
+          getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+          _conn_fail(conn, err ? err : ECONNRESET);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  now = _now_ms();
+  for (int i = 0; i < ctx->max_conns; i++) {
+    modbus_async_conn_t *conn = &ctx->conns[i];
+
+    if (conn->pending && now >= conn->deadline_ms) {
+      // A request cut in the middle would garble the stream, start afresh
+      if (conn->tx_sent > 0 && conn->tx_sent < conn->tx_len)
+        _conn_fail(conn, ETIMEDOUT);
+      else
+        _complete(conn, -1, ETIMEDOUT);
+    }
+    if (conn->state == _CONN_DOWN && now >= conn->reconnect_ms)
+      _start_connect(conn);
+  }
+
+  return n;
+}
@@ -0,0 +1,329 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Change detection. Ranges are found through an open addressing hash on
+ * (unit, table, address, quantity). New data is compared with the last
+ * published snapshot 16 bytes at a time, and only differing blocks are
+ * looked at value by value.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+#include "modbus.h"
+#include "modbus-tag.h"
+#include "modbus-change.h"
+
+typedef struct _range_t {
+  uint64_t key;               // 0 if the slot is free
+  int valid;                  // a snapshot was published
+  int size;                   // bytes per element: 1 for bits, 2 for registers
+  uint16_t nb;
+  void *last;                 // last published values
+  modbus_deadband_t *deadbands;
+  int nb_deadbands;
+} _range_t;
+
+struct modbus_change_t {
+  int max_ranges;
+  int nb_ranges;
+  uint32_t mask;              // number of slots - 1
+  _range_t *slots;
+};
+
+static uint64_t _key(uint8_t unit, uint8_t fn_code, uint16_t addr, uint16_t nb){
+  // fn_code is never 0, neither is the key
+  return (uint64_t)unit << 40 | (uint64_t)fn_code << 32 | (uint32_t)addr << 16 | nb;
+}
+
+static int _element_size(uint8_t fn_code){
+  switch (fn_code) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+      return 1;
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+      return 2;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+/* Finds the range of key, creating it if needed */
+static _range_t *_range_get(modbus_change_t *ctx, uint64_t key, int size, uint16_t nb){
+  uint32_t i = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & ctx->mask;
+  _range_t *r;
+
+  while (ctx->slots[i].key != 0 && ctx->slots[i].key != key)
+    i = (i + 1) & ctx->mask;
+  r = &ctx->slots[i];
+  if (r->key == key)
+    return r;
+
+  if (ctx->nb_ranges >= ctx->max_ranges) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  r->last = calloc(nb ? nb : 1, size);
+  if (r->last == NULL)
+    return NULL;
+  r->key = key;
+  r->size = size;
+  r->nb = nb;
+  ctx->nb_ranges++;
+
+  return r;
+}
+
+/* Flags in diff[] the elements that differ between a and b.
+ * @return: TRUE if any does
+ */
+static int _diff(const uint8_t *a, const uint8_t *b, int nb, int size, uint8_t diff[]){
+  int len = nb * size;
+  int any = FALSE;
+  int i = 0;
+
+  memset(diff, 0, nb);
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&a[i]),
+                                _mm_loadu_si128((const __m128i *)&b[i]));
+    unsigned int neq = ~_mm_movemask_epi8(eq) & 0xFFFF;
+
+    if (neq == 0)
+      continue;
+    any = TRUE;
+    for (int k = 0; k < 16; k++) {
+      if (neq & (1u << k))
+        diff[(i + k) / size] = 1;
+    }
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t eq = vceqq_u8(vld1q_u8(&a[i]), vld1q_u8(&b[i]));
+
+    if (vminvq_u8(eq) == 0xFF)
+      continue;
+    any = TRUE;
+    for (int k = 0; k < 16; k++) {
+      if (a[i + k] != b[i + k])
+        diff[(i + k) / size] = 1;
+    }
+  }
+#endif
+  for (; i < len; i++) {
+    if (a[i] != b[i]) {
+      diff[i / size] = 1;
+      any = TRUE;
+    }
+  }
+
+  return any;
+}
+
+static double _value(const uint16_t *regs, uint8_t type, uint8_t order){
+  uint16_t word = regs[0];
+
+  if (order == MODBUS_ORDER_DCBA || order == MODBUS_ORDER_BADC)
+    word = (uint16_t)(word << 8 | word >> 8);
+
+  switch (type) {
+    case MODBUS_TAG_INT16:   return (int16_t)word;
+    case MODBUS_TAG_UINT16:  return word;
+    case MODBUS_TAG_INT32:   return modbus_get_int32(regs, order);
+    case MODBUS_TAG_UINT32:  return modbus_get_uint32(regs, order);
+    case MODBUS_TAG_INT64:   return (double)modbus_get_int64(regs, order);
+    case MODBUS_TAG_FLOAT32: {
+      uint32_t raw = modbus_get_uint32(regs, order);
+      float f;
+      memcpy(&f, &raw, sizeof(f));
+      return f;
+    }
+    default:                 return modbus_get_double(regs, order);
+  }
+}
+
+/* Clears the changes of values that stayed within their deadband */
+static void _apply_deadbands(const _range_t *r, uint16_t addr, const uint16_t *cur, uint8_t diff[]){
+  const uint16_t *last = r->last;
+
+  for (int d = 0; d < r->nb_deadbands; d++) {
+    const modbus_deadband_t *db = &r->deadbands[d];
+    int off = db->addr - addr;
+    int nb_regs = modbus_tag_nb_registers(db->type);
+    int moved = FALSE;
+    double old_v, new_v, limit;
+
+    for (int i = 0; i < nb_regs; i++)
+      moved |= diff[off + i];
+    if (!moved)
+      continue;
+
+    old_v = _value(&last[off], db->type, db->order);
+    new_v = _value(&cur[off], db->type, db->order);
+    limit = db->mode == MODBUS_DEADBAND_PERCENT ? fabs(old_v) * db->band / 100.0 : db->band;
+
+    // A value is published whole, or not at all
+    moved = fabs(new_v - old_v) > limit || isnan(new_v) != isnan(old_v);
+    for (int i = 0; i < nb_regs; i++)
+      diff[off + i] = moved;
+  }
+}
+
+/** Create a change detector
+ * @param max_ranges: Most (unit, table, address, quantity) ranges tracked at once
+ *
+ * @param return: the detector, NULL with errno set on error
+*/
+modbus_change_t *modbus_change_new(int max_ranges){
+  modbus_change_t *ctx;
+  uint32_t nb_slots = 1;
+
+  if (max_ranges <= 0 || max_ranges > (1 << 24)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  // Keep the table at most half full
+  while (nb_slots < (uint32_t)max_ranges * 2)
+    nb_slots <<= 1;
+
+  ctx = calloc(1, sizeof(*ctx));
+  if (ctx == NULL)
+    return NULL;
+  ctx->slots = calloc(nb_slots, sizeof(*ctx->slots));
+  if (ctx->slots == NULL) {
+    free(ctx);
+    return NULL;
+  }
+  ctx->max_ranges = max_ranges;
+  ctx->mask = nb_slots - 1;
+
+  return ctx;
+}
+
+void modbus_change_free(modbus_change_t *ctx){
+  if (ctx == NULL)
+    return;
+  for (uint32_t i = 0; i <= ctx->mask; i++) {
+    free(ctx->slots[i].last);
+    free(ctx->slots[i].deadbands);
+  }
+  free(ctx->slots);
+  free(ctx);
+}
+
+/** Forget every snapshot, the next response of each range is published whole */
+void modbus_change_reset(modbus_change_t *ctx){
+  for (uint32_t i = 0; i <= ctx->mask; i++)
+    ctx->slots[i].valid = FALSE;
+}
+
+/** Set the deadbands of a register range, replacing previous ones
+ * @param unit: Unit of slave
+ * @param fn_code: MODBUS_FC_READ_HOLDING_REGISTERS or MODBUS_FC_READ_INPUT_REGISTERS
+ * @param addr: First register of the range, as requested
+ * @param nb: Quantity of registers of the range
+ * @param deadbands: Values of the range with a deadband, copied
+ * @param nb_deadbands: Number of deadbands, 0 to remove them
+ *
+ * @param return: 0 if ok, -1 with errno set on error
+*/
+int modbus_change_set_deadbands(modbus_change_t *ctx, uint8_t unit, uint8_t fn_code,
+                                uint16_t addr, uint16_t nb,
+                                const modbus_deadband_t deadbands[], int nb_deadbands){
+  modbus_deadband_t *copy = NULL;
+  _range_t *r;
+
+  if (_element_size(fn_code) != 2 || nb > MODBUS_MAX_READ_REGISTERS || nb_deadbands < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (int i = 0; i < nb_deadbands; i++) {
+    int nb_regs = modbus_tag_nb_registers(deadbands[i].type);
+
+    if (nb_regs < 0 || deadbands[i].addr < addr || deadbands[i].addr + nb_regs > addr + nb ||
+        deadbands[i].order >= MODBUS_ORDER_MAX) {
+      if (MODBUS_DEBUG)
+        fprintf(stderr, "ERROR Deadband #%d at address %d is outside of range %d+%d\n",
+                i, deadbands[i].addr, addr, nb);
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  r = _range_get(ctx, _key(unit, fn_code, addr, nb), 2, nb);
+  if (r == NULL)
+    return -1;
+  if (nb_deadbands > 0) {
+    copy = malloc(nb_deadbands * sizeof(*copy));
+    if (copy == NULL)
+      return -1;
+    memcpy(copy, deadbands, nb_deadbands * sizeof(*copy));
+  }
+  free(r->deadbands);
+  r->deadbands = copy;
+  r->nb_deadbands = nb_deadbands;
+
+  return 0;
+}
+
+/** Compare a parsed response with the last published values of its range
+ * @param frame: Response parsed by modbus_ADU_parser, num_reads elements
+ * @param addr: Address the request started from (not carried by the response)
+ * @param changed: Output, offsets from addr of what changed, in increasing
+ *                 order. Room for frame->num_reads entries is needed.
+ *
+ * @param return: number of entries in changed[], -1 with errno set on error.
+ *                The first response of a range is reported whole.
+*/
+int modbus_change_detect(modbus_change_t *ctx, const modbus_res_frame_t *frame,
+                         uint16_t addr, uint16_t changed[]){
+  uint8_t diff[MODBUS_MAX_READ_BITS];
+  int size = _element_size(frame->fn_code);
+  int nb = frame->num_reads;
+  const uint8_t *cur;
+  uint8_t *last;
+  _range_t *r;
+  int count = 0;
+
+  if (size < 0)
+    return -1;
+  cur = size == 1 ? frame->data->bits : (const uint8_t *)frame->data->registers;
+
+  r = _range_get(ctx, _key(frame->unit, frame->fn_code, addr, nb), size, nb);
+  if (r == NULL)
+    return -1;
+  last = r->last;
+
+  if (!r->valid) {
+    memcpy(last, cur, nb * size);
+    r->valid = TRUE;
+    for (int i = 0; i < nb; i++)
+      changed[i] = i;
+    return nb;
+  }
+
+  if (!_diff(last, cur, nb, size, diff))
+    return 0;
+  if (r->nb_deadbands > 0)
+    _apply_deadbands(r, addr, (const uint16_t *)cur, diff);
+
+  for (int i = 0; i < nb; i++) {
+    if (diff[i]) {
+      changed[count++] = i;
+      memcpy(&last[i * size], &cur[i * size], size);
+    }
+  }
+
+  return count;
+}
@@ -0,0 +1,387 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Conversions between registers and 32/64-bit values in any byte order.
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#if defined(__SSSE3__)
+# include <tmmintrin.h>
+# define _MODBUS_DATA_SSSE3 1
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+// Built for a baseline x86: the SSSE3 kernel is compiled anyway and
+// picked at run time when the CPU has it
+# include <tmmintrin.h>
+# define _MODBUS_DATA_SSSE3 1
+# define _MODBUS_DATA_SSSE3_DISPATCH 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+#include "modbus.h"
+
+/* Every byte order is a XOR of the byte index within the value once
+ * registers sit in memory on a little endian host: byte k of the value
+ * (least significant first) is byte k ^ key of the registers. The same key
+ * converts back, so one kernel serves getters and setters of the arrays.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+# define _MODBUS_DATA_XOR_KERNEL 1
+
+static const uint8_t _xor_key32[MODBUS_ORDER_MAX] = {
+  [MODBUS_ORDER_ABCD] = 2, [MODBUS_ORDER_DCBA] = 1, [MODBUS_ORDER_BADC] = 3, [MODBUS_ORDER_CDAB] = 0
+};
+static const uint8_t _xor_key64[MODBUS_ORDER_MAX] = {
+  [MODBUS_ORDER_ABCD] = 6, [MODBUS_ORDER_DCBA] = 1, [MODBUS_ORDER_BADC] = 7, [MODBUS_ORDER_CDAB] = 0
+};
+
+# ifdef _MODBUS_DATA_SSSE3
+/* Permutes the whole 16-byte chunks of len bytes, returns the bytes done */
+__attribute__((target("ssse3")))
+static size_t _convert_ssse3(const uint8_t *src, uint8_t *dest, size_t len, unsigned int key){
+  uint8_t m[16];
+  __m128i mask;
+  size_t i = 0;
+
+  for (int k = 0; k < 16; k++)
+    m[k] = k ^ key;
+  mask = _mm_loadu_si128((const __m128i *)m);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+    _mm_storeu_si128((__m128i *)&dest[i], _mm_shuffle_epi8(v, mask));
+  }
+  return i;
+}
+# endif
+
+/* The XOR of the byte index as shifts on a whole word: each bit of the key
+ * swaps bytes, 16-bit halves or 32-bit halves. 32-bit values never have
+ * the last bit, so two of them fit in a word.
+ */
+static inline uint64_t _xor_word(uint64_t x, unsigned int key){
+  if (key & 1)
+    x = (x & 0x00FF00FF00FF00FFULL) << 8 | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+  if (key & 2)
+    x = (x & 0x0000FFFF0000FFFFULL) << 16 | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+  if (key & 4)
+    x = x << 32 | x >> 32;
+  return x;
+}
+#endif
+
+static inline uint16_t _bswap16(uint16_t x){
+  return (uint16_t)(x << 8 | x >> 8);
+}
+
+static inline int _swap_bytes(modbus_byte_order_t order){
+  return order == MODBUS_ORDER_DCBA || order == MODBUS_ORDER_BADC;
+}
+
+static inline int _swap_words(modbus_byte_order_t order){
+  return order == MODBUS_ORDER_DCBA || order == MODBUS_ORDER_CDAB;
+}
+
+/* Assembles nb_regs registers (2 or 4) into a value */
+static inline uint64_t _regs_to_raw(const uint16_t *src, int nb_regs, modbus_byte_order_t order){
+  uint64_t raw = 0;
+  int swap_bytes = _swap_bytes(order);
+  int swap_words = _swap_words(order);
+
+  for (int i = 0; i < nb_regs; i++) {
+    uint16_t word = src[swap_words ? nb_regs - 1 - i : i];
+    raw = raw << 16 | (swap_bytes ? _bswap16(word) : word);
+  }
+  return raw;
+}
+
+/* Splits a value into nb_regs registers (2 or 4) */
+static inline void _raw_to_regs(uint64_t raw, uint16_t *dest, int nb_regs, modbus_byte_order_t order){
+  int swap_bytes = _swap_bytes(order);
+  int swap_words = _swap_words(order);
+
+  for (int i = nb_regs - 1; i >= 0; i--) {
+    uint16_t word = (uint16_t)raw;
+    dest[swap_words ? nb_regs - 1 - i : i] = swap_bytes ? _bswap16(word) : word;
+    raw >>= 16;
+  }
+}
+
+/* Converts nb values of size bytes each between registers and host values.
+ * in and out must not overlap. */
+static void _convert_array(const void *in, void *out, int nb, int size, modbus_byte_order_t order,
+                           int to_regs){
+#ifdef _MODBUS_DATA_XOR_KERNEL
+  const uint8_t *src = in;
+  uint8_t *dest = out;
+  size_t len = (size_t)nb * size;
+  size_t i = 0;
+  unsigned int key = size == 4 ? _xor_key32[order] : _xor_key64[order];
+
+  (void)to_regs;
+  if (key == 0) {
+    memcpy(dest, src, len);
+    return;
+  }
+# if defined(_MODBUS_DATA_SSSE3)
+#  ifdef _MODBUS_DATA_SSSE3_DISPATCH
+  if (__builtin_cpu_supports("ssse3"))
+#  endif
+    i = _convert_ssse3(src, dest, len, key);
+# elif defined(__aarch64__) && defined(__ARM_NEON)
+  {
+    uint8_t m[16];
+    uint8x16_t mask;
+    for (int k = 0; k < 16; k++)
+      m[k] = k ^ key;
+    mask = vld1q_u8(m);
+    for (; i + 16 <= len; i += 16)
+      vst1q_u8(&dest[i], vqtbl1q_u8(vld1q_u8(&src[i]), mask));
+  }
+# endif
+  // The rest, or all of it without SIMD, a word at a time
+  for (; i + 8 <= len; i += 8) {
+    uint64_t x;
+    memcpy(&x, &src[i], 8);
+    x = _xor_word(x, key);
+    memcpy(&dest[i], &x, 8);
+  }
+  if (i < len) {
+    // One 32-bit value left
+    uint32_t x;
+    memcpy(&x, &src[i], 4);
+    x = (uint32_t)_xor_word(x, key);
+    memcpy(&dest[i], &x, 4);
+  }
+#else
+  // Portable path, whatever the endianness of the host
+  int nb_regs = size / 2;
+
+  for (int i = 0; i < nb; i++) {
+    if (to_regs) {
+      uint64_t raw = 0;
+      if (size == 4) {
+        uint32_t raw32;
+        memcpy(&raw32, (const uint8_t *)in + (size_t)i * size, 4);
+        raw = raw32;
+      }
+      else
+        memcpy(&raw, (const uint8_t *)in + (size_t)i * size, 8);
+      _raw_to_regs(raw, (uint16_t *)out + (size_t)i * nb_regs, nb_regs, order);
+    }
+    else {
+      uint64_t raw = _regs_to_raw((const uint16_t *)in + (size_t)i * nb_regs, nb_regs, order);
+      if (size == 4) {
+        uint32_t raw32 = (uint32_t)raw;
+        memcpy((uint8_t *)out + (size_t)i * size, &raw32, 4);
+      }
+      else
+        memcpy((uint8_t *)out + (size_t)i * size, &raw, 8);
+    }
+  }
+#endif
+}
+
+static int _check_array(int nb, modbus_byte_order_t order){
+  if (nb < 0 || (unsigned int)order >= MODBUS_ORDER_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+/* Get a float from 4 bytes (Modbus) without any conversion (ABCD) */
+float modbus_get_float_abcd(const uint16_t *src){
+  uint32_t i = (uint32_t)_regs_to_raw(src, 2, MODBUS_ORDER_ABCD);
+  float f;
+  memcpy(&f, &i, sizeof(float));
+  return f;
+}
+
+/* Get a float from 4 bytes (Modbus) in inversed format (DCBA) */
+float modbus_get_float_dcba(const uint16_t *src){
+  uint32_t i = (uint32_t)_regs_to_raw(src, 2, MODBUS_ORDER_DCBA);
+  float f;
+  memcpy(&f, &i, sizeof(float));
+  return f;
+}
+
+/* Get a float from 4 bytes (Modbus) with swapped bytes (BADC) */
+float modbus_get_float_badc(const uint16_t *src){
+  uint32_t i = (uint32_t)_regs_to_raw(src, 2, MODBUS_ORDER_BADC);
+  float f;
+  memcpy(&f, &i, sizeof(float));
+  return f;
+}
+
+/* Get a float from 4 bytes (Modbus) with swapped words (CDAB) */
+float modbus_get_float_cdab(const uint16_t *src){
+  uint32_t i = (uint32_t)_regs_to_raw(src, 2, MODBUS_ORDER_CDAB);
+  float f;
+  memcpy(&f, &i, sizeof(float));
+  return f;
+}
+
+/* DEPRECATED - Get a float from 4 bytes in sort of Modbus format */
+float modbus_get_float(const uint16_t *src){
+  return modbus_get_float_cdab(src);
+}
+
+/* Set a float to 4 bytes for Modbus w/o any conversion (ABCD) */
+void modbus_set_float_abcd(float f, uint16_t *dest){
+  uint32_t i;
+  memcpy(&i, &f, sizeof(uint32_t));
+  _raw_to_regs(i, dest, 2, MODBUS_ORDER_ABCD);
+}
+
+/* Set a float to 4 bytes for Modbus with byte and word swap conversion (DCBA) */
+void modbus_set_float_dcba(float f, uint16_t *dest){
+  uint32_t i;
+  memcpy(&i, &f, sizeof(uint32_t));
+  _raw_to_regs(i, dest, 2, MODBUS_ORDER_DCBA);
+}
+
+/* Set a float to 4 bytes for Modbus with byte swap conversion (BADC) */
+void modbus_set_float_badc(float f, uint16_t *dest){
+  uint32_t i;
+  memcpy(&i, &f, sizeof(uint32_t));
+  _raw_to_regs(i, dest, 2, MODBUS_ORDER_BADC);
+}
+
+/* Set a float to 4 bytes for Modbus with word swap conversion (CDAB) */
+void modbus_set_float_cdab(float f, uint16_t *dest){
+  uint32_t i;
+  memcpy(&i, &f, sizeof(uint32_t));
+  _raw_to_regs(i, dest, 2, MODBUS_ORDER_CDAB);
+}
+
+/* DEPRECATED - Set a float to 4 bytes in a sort of Modbus format! */
+void modbus_set_float(float f, uint16_t *dest){
+  modbus_set_float_cdab(f, dest);
+}
+
+/* Get 32 and 64-bit values from 2 or 4 registers in the given order */
+int32_t modbus_get_int32(const uint16_t *src, modbus_byte_order_t order){
+  return (int32_t)(uint32_t)_regs_to_raw(src, 2, order);
+}
+
+uint32_t modbus_get_uint32(const uint16_t *src, modbus_byte_order_t order){
+  return (uint32_t)_regs_to_raw(src, 2, order);
+}
+
+int64_t modbus_get_int64(const uint16_t *src, modbus_byte_order_t order){
+  return (int64_t)_regs_to_raw(src, 4, order);
+}
+
+double modbus_get_double(const uint16_t *src, modbus_byte_order_t order){
+  uint64_t i = _regs_to_raw(src, 4, order);
+  double d;
+  memcpy(&d, &i, sizeof(double));
+  return d;
+}
+
+/* Set 32 and 64-bit values to 2 or 4 registers in the given order */
+void modbus_set_int32(int32_t value, uint16_t *dest, modbus_byte_order_t order){
+  _raw_to_regs((uint32_t)value, dest, 2, order);
+}
+
+void modbus_set_uint32(uint32_t value, uint16_t *dest, modbus_byte_order_t order){
+  _raw_to_regs(value, dest, 2, order);
+}
+
+void modbus_set_int64(int64_t value, uint16_t *dest, modbus_byte_order_t order){
+  _raw_to_regs((uint64_t)value, dest, 4, order);
+}
+
+void modbus_set_double(double value, uint16_t *dest, modbus_byte_order_t order){
+  uint64_t i;
+  memcpy(&i, &value, sizeof(uint64_t));
+  _raw_to_regs(i, dest, 4, order);
+}
+
+/** Convert a block of registers into nb values at once
+ * @param src: Registers, as filled by modbus_ADU_parser
+ * @param dest: nb values
+ * @param nb: Number of values, src[] holds 2*nb registers (4*nb for 64-bit types)
+ * @param order: Byte order of every value
+ *
+ * @param return: 0 if ok, -1 with errno EINVAL on bad arguments
+*/
+int modbus_get_float_array(const uint16_t *src, float *dest, int nb, modbus_byte_order_t order){
+  if (_check_array(nb, order) == -1)
+    return -1;
+  _convert_array(src, dest, nb, 4, order, FALSE);
+  return 0;
+}
+
+int modbus_get_int32_array(const uint16_t *src, int32_t *dest, int nb, modbus_byte_order_t order){
+  if (_check_array(nb, order) == -1)
+    return -1;
+  _convert_array(src, dest, nb, 4, order, FALSE);
+  return 0;
+}
+
+int modbus_get_uint32_array(const uint16_t *src, uint32_t *dest, int nb, modbus_byte_order_t order){
+  if (_check_array(nb, order) == -1)
+    return -1;
+  _convert_array(src, dest, nb, 4, order, FALSE);
+  return 0;
+}
+
+int modbus_get_int64_array(const uint16_t *src, int64_t *dest, int nb, modbus_byte_order_t order){
+  if (_check_array(nb, order) == -1)
+    return -1;
+  _convert_array(src, dest, nb, 8, order, FALSE);
+  return 0;
+}
+
+int modbus_get_double_array(const uint16_t *src, double *dest, int nb, modbus_byte_order_t order){
+  if (_check_array(nb, order) == -1)
+    return -1;
+  _convert_array(src, dest, nb, 8, order, FALSE);
+  return 0;
+}
+
+/** Convert nb values into a block of registers at once
+ * @param src: nb values
+ * @param dest: Registers, 2*nb of them (4*nb for 64-bit types)
+ * @param nb: Number of values
+ * @param order: Byte order of every value
+ *
+ * @param return: 0 if ok, -1 with errno EINVAL on bad arguments
+*/
+int modbus_set_float_array(const float *src, uint16_t *dest, int nb, modbus_byte_order_t order){
+  if (_check_array(nb, order) == -1)
+    return -1;
+  _convert_array(src, dest, nb, 4, order, TRUE);
+  return 0;
+}
+
+int modbus_set_int32_array(const int32_t *src, uint16_t *dest, int nb, modbus_byte_order_t order){
+  if (_check_array(nb, order) == -1)
+    return -1;
+  _convert_array(src, dest, nb, 4, order, TRUE);
+  return 0;
+}
+
+int modbus_set_uint32_array(const uint32_t *src, uint16_t *dest, int nb, modbus_byte_order_t order){
+  if (_check_array(nb, order) == -1)
+    return -1;
+  _convert_array(src, dest, nb, 4, order, TRUE);
+  return 0;
+}
+
+int modbus_set_int64_array(const int64_t *src, uint16_t *dest, int nb, modbus_byte_order_t order){
+  if (_check_array(nb, order) == -1)
+    return -1;
+  _convert_array(src, dest, nb, 8, order, TRUE);
+  return 0;
+}
+
+int modbus_set_double_array(const double *src, uint16_t *dest, int nb, modbus_byte_order_t order){
+  if (_check_array(nb, order) == -1)
+    return -1;
+  _convert_array(src, dest, nb, 8, order, TRUE);
+  return 0;
+}
@@ -0,0 +1,393 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Shared memory process image. Layout of the mapping:
+ *   header | regions[], sorted by (unit, table, addr) | blocks[]
+ * Every region starts on a new block. A single writer is assumed.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "modbus.h"
+#include "modbus-image.h"
+
+#define _IMAGE_MAGIC    0x4D425049  // "MBPI"
+#define _IMAGE_VERSION  1
+
+typedef struct _image_header_t {
+  _Atomic uint32_t magic;     // set last, once the rest of the image is written
+  uint32_t version;
+  uint32_t size;              // bytes of the whole mapping
+  uint32_t nb_regions;
+  uint32_t nb_blocks;
+  uint32_t blocks_offset;
+} _image_header_t;
+
+typedef struct _image_region_t {
+  modbus_image_region_t def;
+  uint32_t first_block;
+} _image_region_t;
+
+typedef struct _image_block_t {
+  _Alignas(64) _Atomic uint32_t seq;  // odd while the writer is in the block
+  uint16_t region;
+  uint16_t count;             // registers of the region in this block
+  uint16_t values[MODBUS_IMAGE_BLOCK_REGS];
+} _image_block_t;
+
+struct modbus_image_t {
+  void *base;
+  size_t size;
+  int writable;
+  const _image_header_t *header;
+  const _image_region_t *regions;
+  _image_block_t *blocks;
+};
+
+static int _region_cmp(const modbus_image_region_t *a, const modbus_image_region_t *b){
+  if (a->unit != b->unit)
+    return a->unit < b->unit ? -1 : 1;
+  if (a->fn_code != b->fn_code)
+    return a->fn_code < b->fn_code ? -1 : 1;
+  if (a->addr != b->addr)
+    return a->addr < b->addr ? -1 : 1;
+  return 0;
+}
+
+static int _region_qsort_cmp(const void *a, const void *b){
+  return _region_cmp(a, b);
+}
+
+static modbus_image_t *_image_map(int fd, size_t size, int writable){
+  modbus_image_t *img = calloc(1, sizeof(*img));
+
+  if (img == NULL)
+    return NULL;
+  img->base = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (img->base == MAP_FAILED) {
+    free(img);
+    return NULL;
+  }
+  img->size     = size;
+  img->writable = writable;
+  img->header   = img->base;
+  img->regions  = (const _image_region_t *)((const uint8_t *)img->base + sizeof(_image_header_t));
+
+  return img;
+}
+
+/** Create (or recreate) the image and map it for writing. A recreated image
+ * is a new object: processes that mapped the old one keep reading it until
+ * they call modbus_image_open() again.
+ * @param name: Shared memory object name, such as "/modbus-line1"
+ * @param regions: Ranges held by the image, they must not overlap
+ * @param nb_regions: Number of regions
+ *
+ * @param return: the image, NULL with errno set on error
+*/
+modbus_image_t *modbus_image_create(const char *name, const modbus_image_region_t regions[], int nb_regions){
+  modbus_image_region_t *sorted;
+  _image_header_t header;
+  _image_region_t *dest;
+  modbus_image_t *img;
+  uint32_t nb_blocks = 0;
+  size_t size;
+  int fd;
+
+  if (nb_regions <= 0 || nb_regions > UINT16_MAX + 1) {
+    errno = EINVAL;
+    return NULL;
+  }
+  sorted = malloc(nb_regions * sizeof(*sorted));
+  if (sorted == NULL)
+    return NULL;
+  memcpy(sorted, regions, nb_regions * sizeof(*sorted));
+  qsort(sorted, nb_regions, sizeof(*sorted), _region_qsort_cmp);
+
+  for (int i = 0; i < nb_regions; i++) {
+    const modbus_image_region_t *r = &sorted[i];
+    const modbus_image_region_t *prev = i ? &sorted[i - 1] : NULL;
+
+    if (r->nb == 0 || r->addr + r->nb > UINT16_MAX + 1 ||
+        (prev && prev->unit == r->unit && prev->fn_code == r->fn_code && prev->addr + prev->nb > r->addr)) {
+      if (MODBUS_DEBUG)
+        fprintf(stderr, "ERROR Image region unit %d fn 0x%02X at %d+%d is empty or overlaps\n",
+                r->unit, r->fn_code, r->addr, r->nb);
+      free(sorted);
+      errno = EINVAL;
+      return NULL;
+    }
+    nb_blocks += (r->nb + MODBUS_IMAGE_BLOCK_REGS - 1) / MODBUS_IMAGE_BLOCK_REGS;
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.version       = _IMAGE_VERSION;
+  header.nb_regions    = nb_regions;
+  header.nb_blocks     = nb_blocks;
+  header.blocks_offset = sizeof(_image_header_t) + nb_regions * sizeof(_image_region_t);
+  header.blocks_offset = (header.blocks_offset + 63) & ~63u;
+  size = header.blocks_offset + (size_t)nb_blocks * sizeof(_image_block_t);
+  header.size          = (uint32_t)size;
+
+  // A new object rather than resizing the old one under its readers, whose
+  // mappings would fault past the new end. They keep the old image until
+  // they open the name again.
+  if (shm_unlink(name) == -1 && errno != ENOENT) {
+    free(sorted);
+    return NULL;
+  }
+  fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd == -1 || ftruncate(fd, size) == -1) {
+    if (fd != -1)
+      close(fd);
+    free(sorted);
+    return NULL;
+  }
+  img = _image_map(fd, size, TRUE);
+  close(fd);
+  if (img == NULL) {
+    free(sorted);
+    return NULL;
+  }
+
+  dest = (_image_region_t *)((uint8_t *)img->base + sizeof(_image_header_t));
+  img->blocks = (_image_block_t *)((uint8_t *)img->base + header.blocks_offset);
+  for (int i = 0, block = 0; i < nb_regions; i++) {
+    dest[i].def = sorted[i];
+    dest[i].first_block = block;
+    for (int left = sorted[i].nb; left > 0; left -= MODBUS_IMAGE_BLOCK_REGS, block++) {
+      img->blocks[block].region = i;
+      img->blocks[block].count = left < MODBUS_IMAGE_BLOCK_REGS ? left : MODBUS_IMAGE_BLOCK_REGS;
+    }
+  }
+  // The magic goes last: a reader that sees it sees all the above
+  memcpy(img->base, &header, sizeof(header));
+  atomic_store_explicit(&((_image_header_t *)img->base)->magic, _IMAGE_MAGIC, memory_order_release);
+  free(sorted);
+
+  return img;
+}
+
+/** Map an existing image for reading
+ * @param name: Shared memory object name given to modbus_image_create
+ *
+ * @param return: the image, NULL with errno set on error: EAGAIN while the
+ *                writer is still creating it, EMBBADDATA if it is not an image
+*/
+modbus_image_t *modbus_image_open(const char *name){
+  modbus_image_t *img;
+  struct stat st;
+  uint32_t magic;
+  int fd = shm_open(name, O_RDONLY, 0);
+
+  if (fd == -1)
+    return NULL;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(_image_header_t)) {
+    close(fd);
+    // Not sized yet by the writer
+    errno = st.st_size == 0 ? EAGAIN : EMBBADDATA;
+    return NULL;
+  }
+  img = _image_map(fd, st.st_size, FALSE);
+  close(fd);
+  if (img == NULL)
+    return NULL;
+
+  // The magic first, the rest of the header is only valid once it is set
+  magic = atomic_load_explicit(&((_image_header_t *)img->base)->magic, memory_order_acquire);
+  if (magic != _IMAGE_MAGIC || img->header->version != _IMAGE_VERSION ||
+      img->header->size != (uint32_t)st.st_size) {
+    modbus_image_close(img);
+    errno = magic == 0 ? EAGAIN : EMBBADDATA;
+    return NULL;
+  }
+  img->blocks = (_image_block_t *)((uint8_t *)img->base + img->header->blocks_offset);
+
+  return img;
+}
+
+void modbus_image_close(modbus_image_t *img){
+  if (img == NULL)
+    return;
+  munmap(img->base, img->size);
+  free(img);
+}
+
+int modbus_image_unlink(const char *name){
+  return shm_unlink(name);
+}
+
+/** Find where a register lives in the image. The index can be kept and
+ * given to modbus_image_read_index() to skip the lookup.
+ * @param return: index of the register, -1 with errno EMBXILADD if the image does not hold it
+*/
+int modbus_image_lookup(const modbus_image_t *img, uint8_t unit, uint8_t fn_code, uint16_t addr){
+  const modbus_image_region_t key = { unit, fn_code, addr, 0 };
+  int lo = 0, hi = (int)img->header->nb_regions - 1, found = -1;
+  const _image_region_t *r;
+
+  // Last region starting at or before the register
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (_region_cmp(&img->regions[mid].def, &key) <= 0) {
+      found = mid;
+      lo = mid + 1;
+    }
+    else
+      hi = mid - 1;
+  }
+  if (found < 0) {
+    errno = EMBXILADD;
+    return -1;
+  }
+  r = &img->regions[found];
+  if (r->def.unit != unit || r->def.fn_code != fn_code || addr >= r->def.addr + r->def.nb) {
+    errno = EMBXILADD;
+    return -1;
+  }
+
+  return (int)r->first_block * MODBUS_IMAGE_BLOCK_REGS + (addr - r->def.addr);
+}
+
+/** Read registers from an index given by modbus_image_lookup(). Values of
+ * one block are always consistent with each other; a range spanning blocks
+ * may mix two updates of the poller.
+ * @param return: 0 if ok, -1 with errno EMBXILADD if the range leaves its region,
+ *                EAGAIN if a block stayed in the middle of a write for
+ *                MODBUS_IMAGE_READ_RETRIES attempts (writer stopped or died)
+*/
+int modbus_image_read_index(const modbus_image_t *img, int index, int nb, uint16_t dest[]){
+  int block = index / MODBUS_IMAGE_BLOCK_REGS;
+  int offset = index % MODBUS_IMAGE_BLOCK_REGS;
+  int region;
+
+  if (index < 0 || nb < 0 || (uint32_t)block >= img->header->nb_blocks) {
+    errno = EMBXILADD;
+    return -1;
+  }
+  region = img->blocks[block].region;
+
+  while (nb > 0) {
+    _image_block_t *b = &img->blocks[block];
+    uint32_t seq;
+    int n;
+
+    if ((uint32_t)block >= img->header->nb_blocks || b->region != region ||
+        (n = b->count - offset) <= 0) {
+      errno = EMBXILADD;
+      return -1;
+    }
+    if (n > nb)
+      n = nb;
+
+    for (int retries = 0;; retries++) {
+      if (retries == MODBUS_IMAGE_READ_RETRIES) {
+        // The writer stopped in the middle of this block
+        errno = EAGAIN;
+        return -1;
+      }
+      seq = atomic_load_explicit(&b->seq, memory_order_acquire);
+      if (seq & 1)
+        continue;
+      memcpy(dest, &b->values[offset], n * sizeof(uint16_t));
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&b->seq, memory_order_relaxed) == seq)
+        break;
+    }
+
+    dest += n;
+    nb -= n;
+    offset = 0;
+    block++;
+  }
+
+  return 0;
+}
+
+/** Read registers by address, see modbus_image_read_index() */
+int modbus_image_read(const modbus_image_t *img, uint8_t unit, uint8_t fn_code, uint16_t addr,
+                      int nb, uint16_t dest[]){
+  int index = modbus_image_lookup(img, unit, fn_code, addr);
+
+  if (index < 0)
+    return -1;
+  return modbus_image_read_index(img, index, nb, dest);
+}
+
+/** Publish registers, block by block. Never waits for readers.
+ * @param return: 0 if ok, -1 with errno set on error
+*/
+int modbus_image_write(modbus_image_t *img, uint8_t unit, uint8_t fn_code, uint16_t addr,
+                       int nb, const uint16_t src[]){
+  int index, block, offset, region;
+
+  if (!img->writable) {
+    errno = EACCES;
+    return -1;
+  }
+  index = modbus_image_lookup(img, unit, fn_code, addr);
+  if (index < 0)
+    return -1;
+  block = index / MODBUS_IMAGE_BLOCK_REGS;
+  offset = index % MODBUS_IMAGE_BLOCK_REGS;
+  region = img->blocks[block].region;
+  if (addr + nb > img->regions[region].def.addr + img->regions[region].def.nb) {
+    errno = EMBXILADD;
+    return -1;
+  }
+
+  while (nb > 0) {
+    _image_block_t *b = &img->blocks[block];
+    uint32_t seq = atomic_load_explicit(&b->seq, memory_order_relaxed);
+    int n = b->count - offset;
+
+    if (n > nb)
+      n = nb;
+    atomic_store_explicit(&b->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&b->values[offset], src, n * sizeof(uint16_t));
+    atomic_store_explicit(&b->seq, seq + 2, memory_order_release);
+
+    src += n;
+    nb -= n;
+    offset = 0;
+    block++;
+  }
+
+  return 0;
+}
+
+/** Publish every value of a parsed read response
+ * @param frame: Response parsed by modbus_ADU_parser, num_reads elements
+ * @param addr: Address the request started from (not carried by the response)
+ *
+ * @param return: 0 if ok, -1 with errno set on error
+*/
+int modbus_image_write_frame(modbus_image_t *img, const modbus_res_frame_t *frame, uint16_t addr){
+  uint16_t values[UINT8_MAX + 1];
+
+  switch (frame->fn_code) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+      for (int i = 0; i < frame->num_reads; i++)
+        values[i] = frame->data->bits[i];
+      return modbus_image_write(img, frame->unit, frame->fn_code, addr, frame->num_reads, values);
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+      return modbus_image_write(img, frame->unit, frame->fn_code, addr, frame->num_reads,
+                                frame->data->registers);
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
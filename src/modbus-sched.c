@@ -0,0 +1,293 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Earliest-deadline-first scheduler for periodic polls on a RTU line.
+ * It does no I/O and reads no clock: the caller passes the current time in
+ * microseconds, sends what it is told to send and reports back what happened.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "modbus.h"
+#include "modbus-sched.h"
+#include "modbus-rtu-private.h"
+
+/** Initialize a scheduler for a serial line
+ * @param sched: Scheduler to initialize
+ * @param baud: Line speed in bits per second
+ * @param bits_per_char: Bits per character on the wire, 0 for MODBUS_RTU_BITS_PER_CHAR
+ * @param jobs: Storage for the poll jobs, owned by the caller
+ * @param max_jobs: Number of elements of jobs[]
+ *
+ * @param return: 0 if ok, -1 with errno set otherwise
+*/
+int modbus_sched_init(modbus_sched_t *sched, uint32_t baud, uint8_t bits_per_char,
+                      modbus_poll_job_t jobs[], int max_jobs){
+  if (baud == 0 || jobs == NULL || max_jobs <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (bits_per_char == 0)
+    bits_per_char = MODBUS_RTU_BITS_PER_CHAR;
+
+  memset(sched, 0, sizeof(*sched));
+  sched->baud = baud;
+  sched->char_ns = (uint32_t)(((uint64_t)bits_per_char * 1000000000u + baud - 1) / baud);
+  if (baud > MODBUS_RTU_T35_FIXED_BAUD)
+    sched->t35_us = MODBUS_RTU_T35_FIXED_US;
+  else
+    sched->t35_us = (uint32_t)(((uint64_t)sched->char_ns * 35 + 9999) / 10000);
+  sched->jobs = jobs;
+  sched->max_jobs = max_jobs;
+  sched->in_flight = -1;
+
+  return 0;
+}
+
+/** Add a periodic read to the scheduler. The first period starts at now_us.
+ * @param unit: Unit of slave, aka additional address
+ * @param fn_code: MODBUS_FC_READ_COILS, _DISCRETE_INPUTS, _HOLDING_REGISTERS or _INPUT_REGISTERS
+ * @param addr: Start from this physical address (0~65535)
+ * @param nb: Quantity of bits or words to read
+ * @param period_us: Poll period, which is also the relative deadline
+ * @param priority: Tie break between equal deadlines, 0 is most urgent
+ * @param now_us: Current time
+ *
+ * @param return: index of the job, -1 with errno set on error
+*/
+int modbus_sched_add(modbus_sched_t *sched, uint8_t unit, uint8_t fn_code, uint16_t addr,
+                     uint8_t nb, uint32_t period_us, uint8_t priority, uint64_t now_us){
+  modbus_poll_job_t *job;
+
+  if (sched->nb_jobs >= sched->max_jobs) {
+    errno = ENOMEM;
+    return -1;
+  }
+  if (unit == MODBUS_BROADCAST_ADDRESS || unit > MODBUS_MAX_SLAVE_ADDRESS ||
+      period_us == 0 || nb == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  switch (fn_code) {
+#if MODBUS_WITH_READ_BITS
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+      // nb is 8 bits wide so it can never exceed MODBUS_MAX_READ_BITS
+      break;
+#endif
+#if MODBUS_WITH_READ_REGISTERS
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+      if (nb > MODBUS_MAX_READ_REGISTERS) {
+        errno = EMBMDATA;
+        return -1;
+      }
+      break;
+#endif
+    default:  // unknown or left out of the build
+      errno = EINVAL;
+      return -1;
+  }
+
+  job = &sched->jobs[sched->nb_jobs];
+  memset(job, 0, sizeof(*job));
+  job->unit        = unit;
+  job->fn_code     = fn_code;
+  job->addr        = addr;
+  job->nb          = nb;
+  job->priority    = priority;
+  job->period_us   = period_us;
+  job->release_us  = now_us;
+  job->deadline_us = now_us + period_us;
+
+  return sched->nb_jobs++;
+}
+
+/** Time a frame of len bytes spends on the wire, silent interval excluded */
+uint32_t modbus_sched_wire_us(const modbus_sched_t *sched, int len){
+  return (uint32_t)(((uint64_t)sched->char_ns * len + 999) / 1000);
+}
+
+/** Length of the normal response to a poll job
+ * @param return: unit(1), fn_code(1), byte_cnt(1), bytes(N), crc(2)
+*/
+int modbus_sched_rsp_len(const modbus_poll_job_t *job){
+  switch (job->fn_code) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+      return 5 + (job->nb + 7) / 8;
+    default:
+      return 5 + job->nb * 2;
+  }
+}
+
+/** Response timeout for a job, counted from the first byte of the request.
+ * It covers both frames on the wire plus twice the measured slave latency.
+*/
+uint32_t modbus_sched_timeout_us(const modbus_sched_t *sched, int job){
+  const modbus_poll_job_t *j = &sched->jobs[job];
+  uint32_t latency = sched->slaves[j->unit].latency_us;
+  uint32_t allowance = latency ? latency * 2 : MODBUS_SCHED_DEFAULT_LATENCY_US;
+
+  return modbus_sched_wire_us(sched, _MODBUS_RTU_PRESET_REQ_LENGTH + _MODBUS_RTU_CHECKSUM_LENGTH) +
+         modbus_sched_wire_us(sched, modbus_sched_rsp_len(j)) +
+         allowance + sched->t35_us;
+}
+
+/* Moves the deadline of a job past now, counting the periods it missed */
+static void _sched_roll(modbus_poll_job_t *job, uint64_t now_us){
+  uint64_t periods;
+
+  if (job->deadline_us > now_us)
+    return;
+  periods = (now_us - job->deadline_us) / job->period_us + 1;
+  job->misses += (uint32_t)periods;
+  job->release_us = job->deadline_us + (periods - 1) * job->period_us;
+  job->deadline_us = job->release_us + job->period_us;
+}
+
+/* Starts the next period of a job that got its answer (or gave up) */
+static void _sched_advance(modbus_poll_job_t *job){
+  job->release_us = job->deadline_us;
+  job->deadline_us += job->period_us;
+}
+
+static int _sched_gen(const modbus_poll_job_t *job, uint8_t ADU[]){
+  // Only function codes accepted by modbus_sched_add() get here
+  switch (job->fn_code) {
+#if MODBUS_WITH_READ_BITS
+    case MODBUS_FC_READ_COILS:
+      return modbus_read_bits_gen(job->unit, job->addr, job->nb, ADU);
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+      return modbus_read_input_bits_gen(job->unit, job->addr, job->nb, ADU);
+#endif
+#if MODBUS_WITH_READ_REGISTERS
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+      return modbus_read_registers_gen(job->unit, job->addr, job->nb, ADU);
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+      return modbus_read_input_registers_gen(job->unit, job->addr, job->nb, ADU);
+#endif
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+/** Pick the next request to put on the line, earliest deadline first.
+ * Jobs of slaves in back off are skipped. The job is then in flight until
+ * modbus_sched_done() or modbus_sched_timeout() is called.
+ * @param now_us: Current time
+ * @param ADU: byte array to keep the request payload
+ * @param tx_us: When to start transmitting. If nothing is ready, when to call again
+ *
+ * @param return: index of the job, -1 with errno EAGAIN if nothing is ready yet
+ *                or EBUSY if a request is still in flight
+*/
+int modbus_sched_next(modbus_sched_t *sched, uint64_t now_us, uint8_t ADU[], uint64_t *tx_us){
+  uint64_t t = now_us > sched->bus_free_us ? now_us : sched->bus_free_us;
+  uint64_t wake = UINT64_MAX;
+  int best = -1;
+
+  if (sched->in_flight >= 0) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  for (int i = 0; i < sched->nb_jobs; i++) {
+    modbus_poll_job_t *job = &sched->jobs[i];
+    uint64_t ready;
+
+    _sched_roll(job, t);
+    ready = job->release_us;
+    if (sched->slaves[job->unit].backoff_until_us > ready)
+      ready = sched->slaves[job->unit].backoff_until_us;
+
+    if (ready > t) {
+      if (ready < wake)
+        wake = ready;
+      continue;
+    }
+    if (best < 0 ||
+        job->deadline_us < sched->jobs[best].deadline_us ||
+        (job->deadline_us == sched->jobs[best].deadline_us &&
+         job->priority < sched->jobs[best].priority))
+      best = i;
+  }
+
+  if (best < 0) {
+    *tx_us = wake;
+    errno = EAGAIN;
+    return -1;
+  }
+
+  _sched_gen(&sched->jobs[best], ADU);
+  sched->in_flight = best;
+  sched->tx_us = t;
+  *tx_us = t;
+
+  return best;
+}
+
+/** Record when the request of job actually started on the wire, if it
+ * differs from the time given by modbus_sched_next()
+*/
+void modbus_sched_sent(modbus_sched_t *sched, int job, uint64_t tx_us){
+  if (job == sched->in_flight)
+    sched->tx_us = tx_us;
+}
+
+/** Report the response to job as complete, rx_us being the time its last
+ * byte was received. The slave latency estimate is updated from it.
+*/
+void modbus_sched_done(modbus_sched_t *sched, int job, uint64_t rx_us){
+  modbus_poll_job_t *j = &sched->jobs[job];
+  modbus_slave_stat_t *slave = &sched->slaves[j->unit];
+  uint64_t wire = modbus_sched_wire_us(sched, _MODBUS_RTU_PRESET_REQ_LENGTH + _MODBUS_RTU_CHECKSUM_LENGTH) +
+                  modbus_sched_wire_us(sched, modbus_sched_rsp_len(j));
+  uint64_t elapsed = rx_us > sched->tx_us ? rx_us - sched->tx_us : 0;
+  uint32_t turnaround = elapsed > wire ? (uint32_t)(elapsed - wire) : 0;
+
+  // Exponential moving average, 1/8 weight to the new sample
+  if (slave->latency_us == 0)
+    slave->latency_us = turnaround ? turnaround : 1;
+  else
+    slave->latency_us = (slave->latency_us * 7 + turnaround) / 8;
+  if (slave->latency_us == 0)
+    slave->latency_us = 1;  // 0 is kept for "never answered"
+  slave->timeouts = 0;
+  slave->backoff_us = 0;
+  slave->backoff_until_us = 0;
+
+  _sched_advance(j);
+  sched->in_flight = -1;
+  sched->bus_free_us = rx_us + sched->t35_us;
+}
+
+/** Report that job got no (valid) response by now_us. The slave is put in
+ * back off, doubling at each consecutive timeout, so its jobs stop eating
+ * bus time the other slaves could use.
+*/
+void modbus_sched_timeout(modbus_sched_t *sched, int job, uint64_t now_us){
+  modbus_poll_job_t *j = &sched->jobs[job];
+  modbus_slave_stat_t *slave = &sched->slaves[j->unit];
+
+  if (slave->timeouts < UINT16_MAX)
+    slave->timeouts++;
+  if (slave->backoff_us == 0)
+    slave->backoff_us = MODBUS_SCHED_BACKOFF_MIN_US;
+  else if (slave->backoff_us < MODBUS_SCHED_BACKOFF_MAX_US / 2)
+    slave->backoff_us *= 2;
+  else
+    slave->backoff_us = MODBUS_SCHED_BACKOFF_MAX_US;
+  slave->backoff_until_us = now_us + slave->backoff_us;
+
+  if (MODBUS_DEBUG)
+    fprintf(stderr, "ERROR Slave %d timed out, backing off %u us\n",
+            j->unit, slave->backoff_us);
+
+  _sched_advance(j);
+  sched->in_flight = -1;
+  sched->bus_free_us = now_us + sched->t35_us;
+}
@@ -0,0 +1,467 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Compressed columnar store for register values over time.
+ *
+ * Bit fields of a block, after its first sample which is kept in the index:
+ *  timestamp, zigzag(delta-of-delta):
+ *    0                   dod is 0
+ *    10   + 7 bits
+ *    110  + 9 bits
+ *    1110 + 12 bits
+ *    1111 + 32 bits      a larger dod starts a new block
+ *  value, zigzag(delta with the previous value):
+ *    0                   same value
+ *    10   + 4 bits
+ *    110  + 8 bits
+ *    111  + 17 bits
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "modbus.h"
+#include "modbus-series.h"
+
+typedef struct _block_t {
+  uint64_t t_first;
+  uint64_t t_last;
+  uint16_t v_first;
+  uint16_t v_last;
+  uint16_t v_min;
+  uint16_t v_max;
+  uint32_t count;
+  int64_t delta;              // last timestamp delta, encoder state
+  uint32_t nbits;
+  uint32_t cap;               // bytes allocated to data
+  uint8_t *data;
+} _block_t;
+
+typedef struct _series_t {
+  uint32_t key;               // 0 if the slot is free
+  int nb_blocks;
+  int cap_blocks;
+  _block_t *blocks;           // oldest first, the last one is open
+} _series_t;
+
+struct modbus_series_store_t {
+  int max_series;
+  int nb_series;
+  uint32_t mask;              // number of slots - 1
+  _series_t *slots;
+};
+
+static uint32_t _key(uint8_t unit, uint8_t fn_code, uint16_t addr){
+  return (uint32_t)unit << 24 | (uint32_t)fn_code << 16 | addr;
+}
+
+static uint32_t _hash(uint32_t key){
+  return (uint32_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static _series_t *_series_find(const modbus_series_store_t *store, uint32_t key){
+  uint32_t i = _hash(key) & store->mask;
+
+  while (store->slots[i].key != 0) {
+    if (store->slots[i].key == key)
+      return &store->slots[i];
+    i = (i + 1) & store->mask;
+  }
+  return NULL;
+}
+
+static _series_t *_series_get(modbus_series_store_t *store, uint32_t key){
+  uint32_t i = _hash(key) & store->mask;
+
+  while (store->slots[i].key != 0) {
+    if (store->slots[i].key == key)
+      return &store->slots[i];
+    i = (i + 1) & store->mask;
+  }
+  if (store->nb_series >= store->max_series) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  store->slots[i].key = key;
+  store->nb_series++;
+
+  return &store->slots[i];
+}
+
+/* Makes room for n more bits, so that a whole sample is written or none */
+static int _reserve(_block_t *b, int n){
+  uint32_t need = (b->nbits + n + 7) / 8;
+  uint32_t cap = b->cap ? b->cap : 32;
+  uint8_t *data;
+
+  if (need <= b->cap)
+    return 0;
+  while (cap < need)
+    cap *= 2;
+  data = realloc(b->data, cap);
+  if (data == NULL)
+    return -1;
+  memset(&data[b->cap], 0, cap - b->cap);
+  b->data = data;
+  b->cap = cap;
+
+  return 0;
+}
+
+static void _put_bits(_block_t *b, uint32_t bits, int n){
+  for (int i = n - 1; i >= 0; i--) {
+    if ((bits >> i) & 1)
+      b->data[b->nbits >> 3] |= 0x80 >> (b->nbits & 7);
+    b->nbits++;
+  }
+}
+
+static uint32_t _get_bits(const uint8_t *data, uint32_t *pos, int n){
+  uint32_t bits = 0;
+
+  for (int i = 0; i < n; i++) {
+    bits = bits << 1 | ((data[*pos >> 3] >> (7 - (*pos & 7))) & 1);
+    (*pos)++;
+  }
+  return bits;
+}
+
+/* Counts leading 1 bits, up to max */
+static int _get_prefix(const uint8_t *data, uint32_t *pos, int max){
+  int n = 0;
+
+  while (n < max && _get_bits(data, pos, 1))
+    n++;
+  return n;
+}
+
+static void _put_timestamp(_block_t *b, int64_t dod){
+  uint64_t zz = ((uint64_t)dod << 1) ^ (uint64_t)(dod >> 63);
+
+  if (zz == 0)
+    _put_bits(b, 0x0, 1);
+  else if (zz < (1u << 7)) {
+    _put_bits(b, 0x2, 2);
+    _put_bits(b, (uint32_t)zz, 7);
+  }
+  else if (zz < (1u << 9)) {
+    _put_bits(b, 0x6, 3);
+    _put_bits(b, (uint32_t)zz, 9);
+  }
+  else if (zz < (1u << 12)) {
+    _put_bits(b, 0xE, 4);
+    _put_bits(b, (uint32_t)zz, 12);
+  }
+  else {
+    _put_bits(b, 0xF, 4);
+    _put_bits(b, (uint32_t)zz, 32);
+  }
+}
+
+static void _put_value(_block_t *b, int32_t delta){
+  uint32_t zz = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+
+  if (zz == 0)
+    _put_bits(b, 0x0, 1);
+  else if (zz < (1u << 4)) {
+    _put_bits(b, 0x2, 2);
+    _put_bits(b, zz, 4);
+  }
+  else if (zz < (1u << 8)) {
+    _put_bits(b, 0x6, 3);
+    _put_bits(b, zz, 8);
+  }
+  else {
+    _put_bits(b, 0x7, 3);
+    _put_bits(b, zz, 17);
+  }
+}
+
+static int64_t _unzigzag(uint64_t zz){
+  return (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+}
+
+/* Releases the unused tail of a block that will not grow anymore */
+static void _block_seal(_block_t *b){
+  uint32_t used = (b->nbits + 7) / 8;
+
+  if (used == 0) {
+    free(b->data);
+    b->data = NULL;
+    b->cap = 0;
+  }
+  else if (used < b->cap) {
+    uint8_t *data = realloc(b->data, used);
+    if (data != NULL) {
+      b->data = data;
+      b->cap = used;
+    }
+  }
+}
+
+static _block_t *_block_open(_series_t *s, uint64_t t_ms, uint16_t value){
+  _block_t *b;
+
+  if (s->nb_blocks == s->cap_blocks) {
+    int cap = s->cap_blocks ? s->cap_blocks * 2 : 4;
+    _block_t *blocks = realloc(s->blocks, cap * sizeof(*blocks));
+    if (blocks == NULL)
+      return NULL;
+    s->blocks = blocks;
+    s->cap_blocks = cap;
+  }
+  if (s->nb_blocks > 0)
+    _block_seal(&s->blocks[s->nb_blocks - 1]);
+
+  b = &s->blocks[s->nb_blocks++];
+  memset(b, 0, sizeof(*b));
+  b->t_first = b->t_last = t_ms;
+  b->v_first = b->v_last = b->v_min = b->v_max = value;
+  b->count = 1;
+
+  return b;
+}
+
+/** Create a store
+ * @param max_series: Most (unit, table, address) columns held at once
+ *
+ * @param return: the store, NULL with errno set on error
+*/
+modbus_series_store_t *modbus_series_new(int max_series){
+  modbus_series_store_t *store;
+  uint32_t nb_slots = 1;
+
+  if (max_series <= 0 || max_series > (1 << 24)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  // Keep the table at most half full
+  while (nb_slots < (uint32_t)max_series * 2)
+    nb_slots <<= 1;
+
+  store = calloc(1, sizeof(*store));
+  if (store == NULL)
+    return NULL;
+  store->slots = calloc(nb_slots, sizeof(*store->slots));
+  if (store->slots == NULL) {
+    free(store);
+    return NULL;
+  }
+  store->max_series = max_series;
+  store->mask = nb_slots - 1;
+
+  return store;
+}
+
+void modbus_series_free(modbus_series_store_t *store){
+  if (store == NULL)
+    return;
+  for (uint32_t i = 0; i <= store->mask; i++) {
+    _series_t *s = &store->slots[i];
+    for (int j = 0; j < s->nb_blocks; j++)
+      free(s->blocks[j].data);
+    free(s->blocks);
+  }
+  free(store->slots);
+  free(store);
+}
+
+/** Append a sample to a column
+ * @param unit: Unit of slave
+ * @param fn_code: Function code that read the table, never 0
+ * @param addr: Address of the register or bit
+ * @param t_ms: Time of the sample in milliseconds, not older than the last one
+ * @param value: Value of the register, or 0/1 for bits
+ *
+ * @param return: 0 if ok, -1 with errno set on error
+*/
+int modbus_series_append(modbus_series_store_t *store, uint8_t unit, uint8_t fn_code,
+                         uint16_t addr, uint64_t t_ms, uint16_t value){
+  _series_t *s;
+  _block_t *b;
+  int64_t delta, dod;
+  uint64_t zz;
+
+  if (fn_code == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  s = _series_get(store, _key(unit, fn_code, addr));
+  if (s == NULL)
+    return -1;
+
+  if (s->nb_blocks == 0)
+    return _block_open(s, t_ms, value) ? 0 : -1;
+
+  b = &s->blocks[s->nb_blocks - 1];
+  if (t_ms < b->t_last) {
+    errno = EINVAL;
+    return -1;
+  }
+  delta = (int64_t)(t_ms - b->t_last);
+  dod = delta - b->delta;
+  zz = ((uint64_t)dod << 1) ^ (uint64_t)(dod >> 63);
+  if (b->count >= MODBUS_SERIES_BLOCK_SAMPLES || zz > UINT32_MAX)
+    return _block_open(s, t_ms, value) ? 0 : -1;
+
+  // Longest sample: 4 + 32 bits of timestamp, 3 + 17 bits of value
+  if (_reserve(b, 56) == -1)
+    return -1;
+  _put_timestamp(b, dod);
+  _put_value(b, (int32_t)value - b->v_last);
+
+  b->t_last = t_ms;
+  b->delta = delta;
+  b->v_last = value;
+  if (value < b->v_min)
+    b->v_min = value;
+  if (value > b->v_max)
+    b->v_max = value;
+  b->count++;
+
+  return 0;
+}
+
+/** Append every value of a parsed read response, all at the same time
+ * @param frame: Response parsed by modbus_ADU_parser, num_reads elements
+ * @param addr: Address the request started from (not carried by the response)
+ * @param t_ms: Time of the poll in milliseconds
+ *
+ * @param return: 0 if ok, -1 with errno set on error
+*/
+int modbus_series_append_frame(modbus_series_store_t *store, const modbus_res_frame_t *frame,
+                               uint16_t addr, uint64_t t_ms){
+  for (int i = 0; i < frame->num_reads; i++) {
+    uint16_t value;
+
+    switch (frame->fn_code) {
+      case MODBUS_FC_READ_COILS:
+      case MODBUS_FC_READ_DISCRETE_INPUTS:
+        value = frame->data->bits[i];
+        break;
+      case MODBUS_FC_READ_HOLDING_REGISTERS:
+      case MODBUS_FC_READ_INPUT_REGISTERS:
+        value = frame->data->registers[i];
+        break;
+      default:
+        errno = EINVAL;
+        return -1;
+    }
+    if (modbus_series_append(store, frame->unit, frame->fn_code, addr + i, t_ms, value) == -1)
+      return -1;
+  }
+
+  return 0;
+}
+
+/** Drop the blocks whose samples are all older than before_ms. The open
+ * block of a column is kept. Readers must be restarted afterwards.
+*/
+void modbus_series_trim(modbus_series_store_t *store, uint64_t before_ms){
+  for (uint32_t i = 0; i <= store->mask; i++) {
+    _series_t *s = &store->slots[i];
+    int drop = 0;
+
+    while (drop < s->nb_blocks - 1 && s->blocks[drop].t_last < before_ms)
+      free(s->blocks[drop++].data);
+    if (drop == 0)
+      continue;
+    memmove(s->blocks, &s->blocks[drop], (s->nb_blocks - drop) * sizeof(*s->blocks));
+    s->nb_blocks -= drop;
+  }
+}
+
+/** Bytes of memory held by the store */
+size_t modbus_series_memory(const modbus_series_store_t *store){
+  size_t total = sizeof(*store) + (size_t)(store->mask + 1) * sizeof(*store->slots);
+
+  for (uint32_t i = 0; i <= store->mask; i++) {
+    const _series_t *s = &store->slots[i];
+    total += (size_t)s->cap_blocks * sizeof(*s->blocks);
+    for (int j = 0; j < s->nb_blocks; j++)
+      total += s->blocks[j].cap;
+  }
+  return total;
+}
+
+/** Start reading a column
+ * @param from_ms, to_ms: Time span of the samples wanted, both included
+ * @param lo, hi: Value span of the samples wanted, both included (0, 0xFFFF for all)
+ * @param reader: Reader to initialize
+ *
+ * @param return: 0 if ok, -1 with errno ENOENT if the column does not exist
+*/
+int modbus_series_scan(const modbus_series_store_t *store, uint8_t unit, uint8_t fn_code, uint16_t addr,
+                       uint64_t from_ms, uint64_t to_ms, uint16_t lo, uint16_t hi,
+                       modbus_series_reader_t *reader){
+  const _series_t *s = _series_find(store, _key(unit, fn_code, addr));
+
+  if (s == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  memset(reader, 0, sizeof(*reader));
+  reader->series  = s;
+  reader->block   = -1;
+  reader->from_ms = from_ms;
+  reader->to_ms   = to_ms;
+  reader->lo      = lo;
+  reader->hi      = hi;
+
+  return 0;
+}
+
+/** Read the next matching sample
+ * @param return: 1 if a sample was read, 0 at the end of the scan
+*/
+int modbus_series_next(modbus_series_reader_t *reader, uint64_t *t_ms, uint16_t *value){
+  const _series_t *s = reader->series;
+
+  for (;;) {
+    const _block_t *b;
+
+    if (reader->block < 0 || reader->index >= s->blocks[reader->block].count) {
+      // Next block that may hold a match, according to its index. The open
+      // block is never skipped: its span still grows with the appends.
+      int next = reader->block;
+
+      do {
+        if (next + 1 >= s->nb_blocks)
+          return 0;  // call again later to follow new samples
+        b = &s->blocks[++next];
+        if (b->t_first > reader->to_ms)
+          return 0;
+      } while (next < s->nb_blocks - 1 &&
+               (b->t_last < reader->from_ms || b->v_max < reader->lo || b->v_min > reader->hi));
+
+      reader->block  = next;
+      reader->bitpos = 0;
+      reader->index  = 1;
+      reader->t_ms   = b->t_first;
+      reader->delta  = 0;
+      reader->value  = b->v_first;
+    }
+    else {
+      static const int ts_width[] = {0, 7, 9, 12, 32};
+      static const int value_width[] = {0, 4, 8, 17};
+      int n;
+
+      b = &s->blocks[reader->block];
+      n = _get_prefix(b->data, &reader->bitpos, 4);
+      reader->delta += _unzigzag(_get_bits(b->data, &reader->bitpos, ts_width[n]));
+      reader->t_ms += reader->delta;
+      n = _get_prefix(b->data, &reader->bitpos, 3);
+      reader->value += (int32_t)_unzigzag(_get_bits(b->data, &reader->bitpos, value_width[n]));
+      reader->index++;
+    }
+
+    if (reader->t_ms > reader->to_ms)
+      return 0;
+    if (reader->t_ms >= reader->from_ms && reader->value >= reader->lo && reader->value <= reader->hi) {
+      *t_ms = reader->t_ms;
+      *value = reader->value;
+      return 1;
+    }
+  }
+}
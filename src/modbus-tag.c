@@ -0,0 +1,263 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Decode plans: every tag is reduced at compile time to the list of byte
+ * offsets holding its value, most significant first, already corrected for
+ * the byte order on the wire and the endianness of the host. Running a plan
+ * is then one gather loop per value type, with nothing to decide per tag.
+ *
+ * Values go either to an array of doubles, or to the fields of a caller
+ * struct in the type of the tag, so 64-bit integers keep all their bits.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "modbus.h"
+#include "modbus-tag.h"
+
+/** Number of registers spanned by a value of the given type
+ * @param return: 1, 2 or 4, -1 with errno set if the type is unknown
+*/
+int modbus_tag_nb_registers(uint8_t type){
+  switch (type) {
+    case MODBUS_TAG_INT16:
+    case MODBUS_TAG_UINT16:
+      return 1;
+    case MODBUS_TAG_INT32:
+    case MODBUS_TAG_UINT32:
+    case MODBUS_TAG_FLOAT32:
+      return 2;
+    case MODBUS_TAG_INT64:
+    case MODBUS_TAG_FLOAT64:
+      return 4;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+/* The value of the tag is not the raw one, so it goes out as a double */
+static inline int _tag_scaled(const modbus_tag_t *tag){
+  return tag->scale != 1 || tag->offset != 0;
+}
+
+/** Compile a tag schema into a decode plan
+ * @param plan: Plan to fill
+ * @param tags: Schema, the value of tags[i] will be written to values[i],
+ *              or at tags[i].field for modbus_decode_plan_run_struct()
+ * @param nb_tags: Number of tags
+ * @param ops: Storage for the plan, nb_tags elements, owned by the caller
+ *
+ * @param return: 0 if ok, -1 with errno set if a tag is not valid
+*/
+int modbus_decode_plan_compile(modbus_decode_plan_t *plan, const modbus_tag_t tags[], int nb_tags,
+                               modbus_decode_op_t ops[]){
+  const uint16_t probe = 0x0001;
+  // Register bytes sit in host order in regs[]: the high byte is the
+  // second one in memory on little endian hosts
+  unsigned int host_swap = *(const uint8_t *)&probe;
+  uint32_t first = UINT16_MAX, end = 0, struct_size = 0;
+  int count[MODBUS_TAG_TYPE_MAX * 2] = {0};  // by type, then native or scaled
+  int next[MODBUS_TAG_TYPE_MAX * 2];
+
+  if (nb_tags <= 0 || nb_tags > UINT16_MAX + 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (int i = 0; i < nb_tags; i++) {
+    int nb_regs = modbus_tag_nb_registers(tags[i].type);
+
+    if (nb_regs < 0 || tags[i].order >= MODBUS_ORDER_MAX ||
+        (uint32_t)tags[i].addr + nb_regs > UINT16_MAX + 1) {
+      if (MODBUS_DEBUG)
+        fprintf(stderr, "ERROR Invalid tag #%d at address %d\n", i, tags[i].addr);
+      errno = EINVAL;
+      return -1;
+    }
+    if (tags[i].addr < first)
+      first = tags[i].addr;
+    if (tags[i].addr + (uint32_t)nb_regs > end)
+      end = tags[i].addr + nb_regs;
+    count[tags[i].type * 2 + _tag_scaled(&tags[i])]++;
+  }
+
+  // Counting sort by type, so that each type is decoded by a single loop,
+  // native values of a type before the scaled ones for the struct output
+  for (int t = 0, sum = 0; t < MODBUS_TAG_TYPE_MAX; t++) {
+    next[t * 2] = sum;
+    sum += count[t * 2];
+    plan->native_end[t] = sum;
+    next[t * 2 + 1] = sum;
+    sum += count[t * 2 + 1];
+    plan->group_end[t] = sum;
+  }
+
+  for (int i = 0; i < nb_tags; i++) {
+    const modbus_tag_t *tag = &tags[i];
+    modbus_decode_op_t *op = &ops[next[tag->type * 2 + _tag_scaled(tag)]++];
+    int nb_regs = modbus_tag_nb_registers(tag->type);
+    unsigned int swap_bytes = tag->order == MODBUS_ORDER_DCBA || tag->order == MODBUS_ORDER_BADC;
+    unsigned int swap_words = tag->order == MODBUS_ORDER_DCBA || tag->order == MODBUS_ORDER_CDAB;
+
+    memset(op, 0, sizeof(*op));
+    for (int j = 0; j < nb_regs * 2; j++) {
+      unsigned int word = j / 2;
+      unsigned int byte = (j % 2) ^ swap_bytes;
+
+      if (swap_words)
+        word = nb_regs - 1 - word;
+      op->src[j] = (tag->addr - first + word) * 2 + (byte ^ host_swap);
+    }
+    op->dest   = i;
+    op->field  = tag->field;
+    op->scaled = _tag_scaled(tag);
+    op->width  = op->scaled ? (int)sizeof(double) : nb_regs * 2;
+    op->scale  = tag->scale;
+    op->offset = tag->offset;
+    if (op->field + (uint32_t)op->width > struct_size)
+      struct_size = op->field + op->width;
+  }
+
+  plan->addr        = first;
+  plan->nb          = end - first;
+  plan->nb_ops      = nb_tags;
+  plan->struct_size = struct_size;
+  plan->ops         = ops;
+
+  return 0;
+}
+
+/* Assembles the bytes of a value, most significant first */
+static inline uint64_t _gather(const uint8_t *p, const uint32_t src[], int nb_bytes){
+  uint64_t raw = 0;
+  for (int j = 0; j < nb_bytes; j++)
+    raw = raw << 8 | p[src[j]];
+  return raw;
+}
+
+/** Decode the registers of a response into engineering values
+ * @param plan: Compiled plan
+ * @param regs: Registers, as filled by modbus_ADU_parser
+ * @param addr: Address of regs[0]
+ * @param nb: Number of registers in regs[]
+ * @param values: Output, values[i] for tags[i] of the schema. A struct made
+ *                of doubles only, in schema order, can be passed as well.
+ *                64-bit integers beyond 2^53 are rounded, see
+ *                modbus_decode_plan_run_struct() to keep them exact.
+ *
+ * @param return: 0 if ok, -1 with errno EMBBADDATA if regs[] misses registers of the plan
+*/
+int modbus_decode_plan_run(const modbus_decode_plan_t *plan, const uint16_t regs[],
+                           uint16_t addr, int nb, double values[]){
+  const modbus_decode_op_t *ops = plan->ops;
+  const uint8_t *p;
+  int i;
+
+  if (plan->addr < addr || plan->addr + plan->nb > (uint32_t)addr + nb) {
+    errno = EMBBADDATA;
+    return -1;
+  }
+  p = (const uint8_t *)&regs[plan->addr - addr];
+
+  for (i = 0; i < plan->group_end[MODBUS_TAG_INT16]; i++)
+    values[ops[i].dest] = (int16_t)_gather(p, ops[i].src, 2) * ops[i].scale + ops[i].offset;
+
+  for (; i < plan->group_end[MODBUS_TAG_UINT16]; i++)
+    values[ops[i].dest] = (uint16_t)_gather(p, ops[i].src, 2) * ops[i].scale + ops[i].offset;
+
+  for (; i < plan->group_end[MODBUS_TAG_INT32]; i++)
+    values[ops[i].dest] = (int32_t)_gather(p, ops[i].src, 4) * ops[i].scale + ops[i].offset;
+
+  for (; i < plan->group_end[MODBUS_TAG_UINT32]; i++)
+    values[ops[i].dest] = (uint32_t)_gather(p, ops[i].src, 4) * ops[i].scale + ops[i].offset;
+
+  // Beyond 2^53 the value gets rounded to the nearest double
+  for (; i < plan->group_end[MODBUS_TAG_INT64]; i++)
+    values[ops[i].dest] = (int64_t)_gather(p, ops[i].src, 8) * ops[i].scale + ops[i].offset;
+
+  for (; i < plan->group_end[MODBUS_TAG_FLOAT32]; i++) {
+    uint32_t raw = (uint32_t)_gather(p, ops[i].src, 4);
+    float f;
+    memcpy(&f, &raw, sizeof(f));
+    values[ops[i].dest] = f * ops[i].scale + ops[i].offset;
+  }
+
+  for (; i < plan->group_end[MODBUS_TAG_FLOAT64]; i++) {
+    uint64_t raw = _gather(p, ops[i].src, 8);
+    double d;
+    memcpy(&d, &raw, sizeof(d));
+    values[ops[i].dest] = d * ops[i].scale + ops[i].offset;
+  }
+
+  return 0;
+}
+
+static inline float _to_float(uint32_t raw){
+  float f;
+  memcpy(&f, &raw, sizeof(f));
+  return f;
+}
+
+static inline double _to_double(uint64_t raw){
+  double d;
+  memcpy(&d, &raw, sizeof(d));
+  return d;
+}
+
+/* The two loops of a type: fields of the type itself, then scaled into doubles */
+#define _STORE_GROUP(type, ctype, decode) \
+  do { \
+    for (; i < plan->native_end[type]; i++) { \
+      ctype v_ = decode; \
+      memcpy(dest + ops[i].field, &v_, sizeof(v_)); \
+    } \
+    for (; i < plan->group_end[type]; i++) { \
+      double v_ = (decode) * ops[i].scale + ops[i].offset; \
+      memcpy(dest + ops[i].field, &v_, sizeof(v_)); \
+    } \
+  } while (0)
+
+/** Decode the registers of a response into the fields of a struct. A tag
+ * without scale nor offset (1 and 0) is written in its own type: int16_t,
+ * uint16_t, int32_t, uint32_t, int64_t, float or double. Other tags are
+ * written as the double raw * scale + offset.
+ * @param plan: Compiled plan
+ * @param regs: Registers, as filled by modbus_ADU_parser
+ * @param addr: Address of regs[0]
+ * @param nb: Number of registers in regs[]
+ * @param out: Output struct, tags[i] goes at tags[i].field
+ * @param size: Size of the struct, at least plan->struct_size
+ *
+ * @param return: 0 if ok, -1 with errno EMBBADDATA if regs[] misses registers of the plan,
+ *                EINVAL if the struct is too small for the fields of the plan
+*/
+int modbus_decode_plan_run_struct(const modbus_decode_plan_t *plan, const uint16_t regs[],
+                                  uint16_t addr, int nb, void *out, size_t size){
+  const modbus_decode_op_t *ops = plan->ops;
+  uint8_t *dest = out;
+  const uint8_t *p;
+  int i = 0;
+
+  if (plan->addr < addr || plan->addr + plan->nb > (uint32_t)addr + nb) {
+    errno = EMBBADDATA;
+    return -1;
+  }
+  if (size < plan->struct_size) {
+    errno = EINVAL;
+    return -1;
+  }
+  p = (const uint8_t *)&regs[plan->addr - addr];
+
+  _STORE_GROUP(MODBUS_TAG_INT16,   int16_t,  (int16_t)_gather(p, ops[i].src, 2));
+  _STORE_GROUP(MODBUS_TAG_UINT16,  uint16_t, (uint16_t)_gather(p, ops[i].src, 2));
+  _STORE_GROUP(MODBUS_TAG_INT32,   int32_t,  (int32_t)_gather(p, ops[i].src, 4));
+  _STORE_GROUP(MODBUS_TAG_UINT32,  uint32_t, (uint32_t)_gather(p, ops[i].src, 4));
+  _STORE_GROUP(MODBUS_TAG_INT64,   int64_t,  (int64_t)_gather(p, ops[i].src, 8));
+  _STORE_GROUP(MODBUS_TAG_FLOAT32, float,    _to_float((uint32_t)_gather(p, ops[i].src, 4)));
+  _STORE_GROUP(MODBUS_TAG_FLOAT64, double,   _to_double(_gather(p, ops[i].src, 8)));
+
+  return 0;
+}
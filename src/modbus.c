@@ -31,6 +31,7 @@ typedef enum {
 } _step_t;
 
 const char *modbus_strerror(int errnum) {
+#if MODBUS_WITH_ERROR_STRINGS
   switch (errnum) {
     // Modbus error code
     case EMBXILFUN:     return "Illegal function";
@@ -50,12 +51,21 @@ const char *modbus_strerror(int errnum) {
     case EMBBADEXC:     return "Invalid exception code";
     case EMBMDATA:      return "Too many data";
     case EMBBADSLAVE:   return "Response not from requested slave";
+    case EMBUNKFUN:     return "Unknown function code";
     default:
       return strerror(errnum);
     }
+#else
+  if (errnum > MODBUS_ENOBASE && errnum <= EMBXGTAR)
+    return "Modbus exception";
+  if (errnum > EMBXGTAR && errnum <= EMBUNKFUN)
+    return "Modbus error";
+  return strerror(errnum);
+#endif
 }
 
 
+#if MODBUS_WITH_READ_BITS || MODBUS_WITH_READ_REGISTERS || MODBUS_WITH_WRITE
 /* Builds a RTU request header */
 static int _modbus_rtu_build_request_basis(uint8_t unit, uint8_t function, uint16_t addr, uint16_t nb, uint8_t *req){
   req[0] = unit;
@@ -67,6 +77,7 @@ static int _modbus_rtu_build_request_basis(uint8_t unit, uint8_t function, uint1
 
   return _MODBUS_RTU_PRESET_REQ_LENGTH;
 }
+#endif
 
 /** This method calculates CRC-16/modus and returns in (hi-byte, lo-byte)
  * @param buf[]: Target to calculates crc from
@@ -75,7 +86,7 @@ static int _modbus_rtu_build_request_basis(uint8_t unit, uint8_t function, uint1
  *         CRC-Hi = return >> 8
  *         CRC-Lo = return & 0x00FF
  */
-static uint16_t _calc_CRC(uint8_t buf[], uint8_t len){
+uint16_t _calc_CRC(uint8_t buf[], uint8_t len){
   unsigned int crc, flag;
   crc = 0xFFFF;
   for(uint8_t i = 0; i < len; i++)
@@ -98,7 +109,7 @@ static uint16_t _calc_CRC(uint8_t buf[], uint8_t len){
  * @param len: The length of payload consist in buf[]
  * @return len+2, the length of entire packet, including crc checksum
  */
-static int _CRC_concatenate(uint8_t buf[], uint8_t len){
+int _CRC_concatenate(uint8_t buf[], uint8_t len){
   
   // Calculate CRC-16/modbus
   unsigned int temp;
@@ -123,6 +134,7 @@ void _error_print(modbus_t *ctx, const char *context)
   }
 }
 
+#if MODBUS_WITH_READ_BITS
 /** Generate a modbus RTU payload to read coils and stored the payload in ADU
  * @param unit: Unit of slave, aka additional address
  * @param addr: Start from this physical address (0~65535)
@@ -181,7 +193,9 @@ int modbus_read_input_bits_gen(uint8_t unit, uint16_t addr, uint8_t nb, uint8_t
   return len;
 
 }
+#endif
 
+#if MODBUS_WITH_READ_REGISTERS
 /** Generate a modbus RTU payload to read holding registers and stored the payload in ADU
  * @param unit: Unit of slave, aka additional address
  * @param addr: Start from this physical address (0~65535)
@@ -239,7 +253,9 @@ int modbus_read_input_registers_gen(uint8_t unit, uint16_t addr, uint8_t nb, uin
   
   return len;
 }
+#endif
 
+#if MODBUS_WITH_WRITE
 /** Generate a modbus RTU payload to wrtie single bit to coil status and stored the payload in ADU
  * @param unit: Unit of slave, aka additional address
  * @param addr: Start from this physical address (0~65535)
@@ -367,6 +383,7 @@ int modbus_write_registers_gen(uint8_t unit, uint16_t addr, uint8_t nb, const ui
   
   return len;
 }
+#endif
 
 // Return 0 if ok, -1 on if error, exception code otherwise
 int modbus_ADU_parser(modbus_res_frame_t *frame){
@@ -384,24 +401,35 @@ int modbus_ADU_parser(modbus_res_frame_t *frame){
   else{
     switch(frame->fn_code) { // get PDU length
       // Reading response
+#if MODBUS_WITH_READ_BITS
       case MODBUS_FC_READ_COILS:
       case MODBUS_FC_READ_DISCRETE_INPUTS:
+#endif
+#if MODBUS_WITH_READ_REGISTERS
       case MODBUS_FC_READ_HOLDING_REGISTERS:
       case MODBUS_FC_READ_INPUT_REGISTERS:
+#endif
+#if MODBUS_WITH_READ_BITS || MODBUS_WITH_READ_REGISTERS
         frame->ADU_len = 2 + frame->ADU[2]; // fn_code(1), byte_cnt(1), bytes(N)
         break;
+#endif
 
       // Writing response
+#if MODBUS_WITH_WRITE
       case MODBUS_FC_WRITE_SINGLE_COIL:
       case MODBUS_FC_WRITE_SINGLE_REGISTER:
       case MODBUS_FC_WRITE_MULTIPLE_COILS:
       case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
         frame->ADU_len = 5;  // fn_code(1), start addr(2), quantity(2)
         break;
+#endif
 
       default:
+        // Unknown, or left out of this build (see modbus-config.h)
+        errno = EMBUNKFUN;
         if(MODBUS_DEBUG)
           fprintf(stderr, "FATAL Unknow function code:0x%X\n", frame->fn_code);
+        return -1;
     }
     frame->ADU_len += 3; // 3 more bytes: unit(1), CRC(2)
   }
@@ -427,17 +455,16 @@ int modbus_ADU_parser(modbus_res_frame_t *frame){
     return frame->ADU[2]; // The #2 byte in ADU is exception code
   }
 
-  // Read values from ADU if it's a read request
-  uint16_t *dest_reg = frame->data->registers;  // a shorter expression
-  uint8_t  *dest_bit = frame->data->bits;       // a shorter expression
-  uint8_t *rsp = frame->ADU;                    // a shorter expression
-  int index_bits = 0;     // Use for read coils and discrete inputs, dest_bit[index_bits]
-  int offset = 3;         // unit(1), fn_code(1), bytes_cnt(1)
-  int offset_end;
+  // Read values from ADU if it's a read request, the others are checked above
   switch (frame->fn_code) {
+#if MODBUS_WITH_READ_BITS
     case MODBUS_FC_READ_COILS:
-    case MODBUS_FC_READ_DISCRETE_INPUTS:
-      offset_end = frame->ADU_len-2; // -2 due to CRC
+    case MODBUS_FC_READ_DISCRETE_INPUTS: {
+      uint8_t *dest_bit = frame->data->bits;    // a shorter expression
+      uint8_t *rsp = frame->ADU;                // a shorter expression
+      int index_bits = 0;   // dest_bit[index_bits]
+      int offset = 3;       // unit(1), fn_code(1), bytes_cnt(1)
+      int offset_end = frame->ADU_len-2; // -2 due to CRC
       // Extract 8 bits from each byte
       for (int i=offset; i<offset_end; i++) {
         for (int bit = 0x01; (bit & 0xff) && (index_bits < frame->num_reads);) {
@@ -447,9 +474,14 @@ int modbus_ADU_parser(modbus_res_frame_t *frame){
         }
       }
       break;
+    }
+#endif
 
+#if MODBUS_WITH_READ_REGISTERS
     case MODBUS_FC_READ_HOLDING_REGISTERS:
-    case MODBUS_FC_READ_INPUT_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS: {
+      uint16_t *dest_reg = frame->data->registers;  // a shorter expression
+      uint8_t *rsp = frame->ADU;                    // a shorter expression
       frame->num_reads = frame->ADU[2]/2;
       // Extract received bytes into registers (2 bytes as 1 register)
       for (int i=0; i < frame->num_reads; i++) {
@@ -459,6 +491,8 @@ int modbus_ADU_parser(modbus_res_frame_t *frame){
                        rsp[4 + (i*2)];
       }
       break;
+    }
+#endif
 
     default:;
   }
@@ -466,3 +500,215 @@ int modbus_ADU_parser(modbus_res_frame_t *frame){
   return 0;
 }
 
+/** Get the total length of a response ADU from its first bytes, so that a
+ * stream reader knows when the frame is complete
+ * @param ADU: bytes received so far
+ * @param len: number of bytes in ADU[]
+ *
+ * @param return: length of the whole ADU, 0 if more bytes are needed to tell,
+ *                -1 with errno EMBUNKFUN if the function code is unknown or
+ *                left out of this build, EMBBADDATA if the byte count is
+ *                above 250
+*/
+int modbus_ADU_length(const uint8_t ADU[], int len){
+  if (len < 2)
+    return 0;
+  if (ADU[1] & 0x80)
+    return 5;  // unit(1), fn_code(1), exeception code(1), crc(2)
+
+  // Same function codes as modbus_ADU_parser() in this build
+  switch (ADU[1]) {
+#if MODBUS_WITH_READ_BITS
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+#endif
+#if MODBUS_WITH_READ_REGISTERS
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+#endif
+#if MODBUS_WITH_READ_BITS || MODBUS_WITH_READ_REGISTERS
+      if (len < 3)
+        return 0;
+      if (ADU[2] > MODBUS_MAX_READ_REGISTERS * 2) {
+        // More than any request can ask for, nor fit in frame->ADU_len
+        errno = EMBBADDATA;
+        return -1;
+      }
+      return 5 + ADU[2];  // unit(1), fn_code(1), byte_cnt(1), bytes(N), crc(2)
+#endif
+
+#if MODBUS_WITH_WRITE
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+      return 8;  // unit(1), fn_code(1), start addr(2), quantity(2), crc(2)
+#endif
+
+    default:
+      errno = EMBUNKFUN;
+      return -1;
+  }
+}
+
+#if MODBUS_WITH_SLAVE
+/** Get the total length of a RTU request from its first bytes, so that a
+ * slave reading a stream knows when the request is complete
+ * @param req: bytes received so far
+ * @param len: number of bytes in req[]
+ *
+ * @param return: length of the whole request, 0 if more bytes are needed to tell
+*/
+int modbus_request_length(const uint8_t req[], int len){
+  if (len < 2)
+    return 0;
+  switch (req[1]) {
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+      if (len < 7)
+        return 0;
+      return 9 + req[6];  // header(6), byte_cnt(1), bytes(N), crc(2)
+    default:
+      return _MODBUS_RTU_PRESET_REQ_LENGTH + _MODBUS_RTU_CHECKSUM_LENGTH;
+  }
+}
+
+/* Builds an exception response, none to broadcast requests */
+static int _modbus_reply_exception_gen(const uint8_t req[], uint8_t code, uint8_t rsp[]){
+  if (req[0] == MODBUS_BROADCAST_ADDRESS)
+    return 0;
+  rsp[0] = req[0];
+  rsp[1] = req[1] | 0x80;
+  rsp[2] = code;
+  return _CRC_concatenate(rsp, 3);
+}
+
+/** Answer a RTU request from a register mapping, as a slave would. Used to
+ * stand in for real devices when testing a master.
+ * @param req: Request ADU, CRC included
+ * @param req_len: Length of req[]
+ * @param map: Tables to read from and write to
+ * @param rsp: byte array to keep the response, MODBUS_MAX_ADU_LENGTH long
+ *
+ * @param return: length of rsp[], 0 if no response must be sent (broadcast),
+ *                -1 with errno set if the request is malformed
+*/
+int modbus_reply_gen(const uint8_t req[], int req_len, modbus_mapping_t *map, uint8_t rsp[]){
+  uint8_t fn_code;
+  uint16_t addr, nb;
+  int len;
+
+  if (req_len < _MODBUS_RTU_PRESET_REQ_LENGTH + _MODBUS_RTU_CHECKSUM_LENGTH) {
+    errno = EMBBADDATA;
+    return -1;
+  }
+  if (_calc_CRC((uint8_t *)req, req_len - 2) != (req[req_len-1] << 8 | req[req_len-2])) {
+    errno = EMBBADCRC;
+    return -1;
+  }
+
+  fn_code = req[1];
+  addr = req[2] << 8 | req[3];
+  nb   = req[4] << 8 | req[5];
+
+  switch (fn_code) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS: {
+      const uint8_t *tab = fn_code == MODBUS_FC_READ_COILS ? map->tab_bits : map->tab_input_bits;
+      int start = fn_code == MODBUS_FC_READ_COILS ? map->start_bits : map->start_input_bits;
+      int count = fn_code == MODBUS_FC_READ_COILS ? map->nb_bits : map->nb_input_bits;
+      int byte_count = (nb / 8) + ((nb % 8) ? 1 : 0);
+
+      if (nb < 1 || nb > MODBUS_MAX_READ_BITS)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, rsp);
+      if (addr < start || addr - start + nb > count)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
+
+      rsp[0] = req[0];
+      rsp[1] = fn_code;
+      rsp[2] = byte_count;
+      len = 3;
+      memset(&rsp[len], 0, byte_count);
+      for (int i = 0; i < nb; i++) {
+        if (tab[addr - start + i])
+          rsp[len + i / 8] |= 1 << (i % 8);
+      }
+      len += byte_count;
+      break;
+    }
+
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS: {
+      const uint16_t *tab = fn_code == MODBUS_FC_READ_HOLDING_REGISTERS ? map->tab_registers : map->tab_input_registers;
+      int start = fn_code == MODBUS_FC_READ_HOLDING_REGISTERS ? map->start_registers : map->start_input_registers;
+      int count = fn_code == MODBUS_FC_READ_HOLDING_REGISTERS ? map->nb_registers : map->nb_input_registers;
+
+      if (nb < 1 || nb > MODBUS_MAX_READ_REGISTERS)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, rsp);
+      if (addr < start || addr - start + nb > count)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
+
+      rsp[0] = req[0];
+      rsp[1] = fn_code;
+      rsp[2] = nb * 2;
+      len = 3;
+      for (int i = 0; i < nb; i++) {
+        rsp[len++] = tab[addr - start + i] >> 8;
+        rsp[len++] = tab[addr - start + i] & 0x00FF;
+      }
+      break;
+    }
+
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+      if (nb != 0xFF00 && nb != 0x0000)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, rsp);
+      if (addr < map->start_bits || addr - map->start_bits >= map->nb_bits)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
+      map->tab_bits[addr - map->start_bits] = nb ? ON : OFF;
+      memcpy(rsp, req, _MODBUS_RTU_PRESET_REQ_LENGTH);  // echo of the request
+      len = _MODBUS_RTU_PRESET_REQ_LENGTH;
+      break;
+
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+      if (addr < map->start_registers || addr - map->start_registers >= map->nb_registers)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
+      map->tab_registers[addr - map->start_registers] = nb;
+      memcpy(rsp, req, _MODBUS_RTU_PRESET_REQ_LENGTH);
+      len = _MODBUS_RTU_PRESET_REQ_LENGTH;
+      break;
+
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+      if (nb < 1 || nb > MODBUS_MAX_WRITE_BITS || req_len < 9 + (nb + 7) / 8 ||
+          req[6] != (nb + 7) / 8)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, rsp);
+      if (addr < map->start_bits || addr - map->start_bits + nb > map->nb_bits)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
+      for (int i = 0; i < nb; i++)
+        map->tab_bits[addr - map->start_bits + i] = (req[7 + i / 8] >> (i % 8)) & 0x01;
+      memcpy(rsp, req, _MODBUS_RTU_PRESET_REQ_LENGTH);
+      len = _MODBUS_RTU_PRESET_REQ_LENGTH;
+      break;
+
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+      if (nb < 1 || nb > MODBUS_MAX_WRITE_REGISTERS || req_len < 9 + nb * 2 ||
+          req[6] != nb * 2)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, rsp);
+      if (addr < map->start_registers || addr - map->start_registers + nb > map->nb_registers)
+        return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
+      for (int i = 0; i < nb; i++)
+        map->tab_registers[addr - map->start_registers + i] = req[7 + i * 2] << 8 | req[8 + i * 2];
+      memcpy(rsp, req, _MODBUS_RTU_PRESET_REQ_LENGTH);
+      len = _MODBUS_RTU_PRESET_REQ_LENGTH;
+      break;
+
+    default:
+      return _modbus_reply_exception_gen(req, MODBUS_EXCEPTION_ILLEGAL_FUNCTION, rsp);
+  }
+
+  // No response to broadcast requests
+  if (req[0] == MODBUS_BROADCAST_ADDRESS)
+    return 0;
+
+  return _CRC_concatenate(rsp, len);
+}
+#endif
@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+#
+# Builds and runs the tests. Each one is a program linked with the sources
+# it covers, and fails with a non-zero exit status. A test in C++ is
+# linked with the library sources built by the C compiler.
+#
+#   tests/run-tests.sh [name...]
+
+set -e
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2 -g -std=gnu11 -Wall -DMODBUS_DEBUG=0}
+CXX=${CXX:-c++}
+CXXFLAGS=${CXXFLAGS:--O2 -g -std=c++20 -Wall -DMODBUS_DEBUG=0}
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# name, then the library sources it needs
+TESTS="
+test-sched   modbus.c modbus-sched.c
+test-async   modbus.c modbus-async.c
+test-series  modbus.c modbus-series.c
+test-image   modbus.c modbus-image.c
+test-tag     modbus.c modbus-data.c modbus-tag.c
+test-change  modbus.c modbus-data.c modbus-tag.c modbus-change.c
+test-hpp     modbus.c
+"
+
+failed=0
+while read -r name sources; do
+  [ -n "$name" ] || continue
+  if [ $# -gt 0 ]; then
+    case " $* " in *" $name "*) ;; *) continue ;; esac
+  fi
+  srcs=
+  for src in $sources; do
+    srcs="$srcs $TOP/src/$src"
+  done
+  if [ -f "$TOP/tests/$name.cpp" ]; then
+    objs=
+    for src in $srcs; do
+      obj="$TMP/$name-$(basename "$src" .c).o"
+      $CC $CFLAGS -I"$TOP/inc" -c "$src" -o "$obj"
+      objs="$objs $obj"
+    done
+    $CXX $CXXFLAGS -I"$TOP/inc" "$TOP/tests/$name.cpp" $objs -o "$TMP/$name" -lm
+  else
+    $CC $CFLAGS -I"$TOP/inc" "$TOP/tests/$name.c" $srcs -o "$TMP/$name" -lm
+  fi
+  "$TMP/$name" || failed=1
+done <<EOF
+$TESTS
+EOF
+
+exit $failed
@@ -0,0 +1,314 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* modbus-async over loopback TCP, in both framings: a client link talks to
+ * the stand-in slave of modbus_async_listen in the same event loop. Link
+ * failures are played by a bare socket the test accepts and drops.
+ */
+
+#define _GNU_SOURCE   // accept4
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "modbus.h"
+#include "modbus-async.h"
+#include "test.h"
+
+#define TABLE_SIZE  32
+
+typedef struct result_t {
+    int done;
+    int rc;
+    int err;
+} result_t;
+
+static void _on_response(modbus_async_conn_t *conn, int rc, modbus_res_frame_t *frame, void *user){
+  result_t *res = user;
+
+  (void)conn;
+  (void)frame;
+  res->done = 1;
+  res->rc = rc;
+  res->err = errno;
+}
+
+/* Runs the loop until *flag is set or timeout_ms went by */
+static int _run_until(modbus_async_t *ctx, const int *flag, int timeout_ms){
+  uint64_t deadline = test_now_us() + timeout_ms * 1000ULL;
+
+  while (!*flag && test_now_us() < deadline)
+    modbus_async_run(ctx, 10);
+  return *flag;
+}
+
+static int _wait_connected(modbus_async_t *ctx, modbus_async_conn_t *conn, int timeout_ms){
+  uint64_t deadline = test_now_us() + timeout_ms * 1000ULL;
+
+  while (!modbus_async_is_connected(conn) && test_now_us() < deadline)
+    modbus_async_run(ctx, 10);
+  return modbus_async_is_connected(conn);
+}
+
+static result_t _transact(modbus_async_t *ctx, modbus_async_conn_t *conn, const uint8_t ADU[], int len,
+                          modbus_res_frame_t *frame){
+  result_t res = { 0 };
+
+  TEST_CHECK(modbus_async_submit(conn, ADU, len, frame, _on_response, &res) == 0,
+             "submit: %s", strerror(errno));
+  TEST_CHECK(_run_until(ctx, &res.done, 3000), "no callback");
+  return res;
+}
+
+static void _test_slave(int framing){
+  uint8_t bits[TABLE_SIZE] = { 0 }, input_bits[TABLE_SIZE] = { 0 };
+  uint16_t registers[TABLE_SIZE], input_registers[TABLE_SIZE] = { 0 };
+  modbus_mapping_t map = {
+    .nb_bits = TABLE_SIZE, .nb_input_bits = TABLE_SIZE,
+    .nb_input_registers = TABLE_SIZE, .nb_registers = TABLE_SIZE,
+    .tab_bits = bits, .tab_input_bits = input_bits,
+    .tab_input_registers = input_registers, .tab_registers = registers
+  };
+  uint8_t bits_read[TABLE_SIZE];
+  uint16_t regs_read[TABLE_SIZE];
+  modbus_res_data_t data = { bits_read, regs_read };
+  modbus_res_frame_t frame = { .data = &data };
+  modbus_async_t *ctx = modbus_async_new(4);
+  modbus_async_conn_t *server, *client;
+  uint8_t ADU[MODBUS_MAX_ADU_LENGTH];
+  result_t res;
+  int len;
+
+  for (int i = 0; i < TABLE_SIZE; i++)
+    registers[i] = 0x1000 + i;
+
+  server = modbus_async_listen(ctx, "127.0.0.1", 0, framing, &map);
+  TEST_CHECK(server != NULL, "listen: %s", strerror(errno));
+  if (server == NULL)
+    return;
+  client = modbus_async_connect(ctx, "127.0.0.1", modbus_async_port(server), framing);
+  TEST_CHECK(client != NULL && _wait_connected(ctx, client, 2000), "framing %d: not connected", framing);
+
+  // Normal read
+  len = modbus_read_registers_gen(1, 4, 3, ADU);
+  res = _transact(ctx, client, ADU, len, &frame);
+  TEST_CHECK(res.rc == 0, "framing %d: read returned %d", framing, res.rc);
+  TEST_CHECK(frame.num_reads == 3 && regs_read[0] == 0x1004 && regs_read[2] == 0x1006,
+             "framing %d: read %d registers, 0x%04X..0x%04X", framing,
+             frame.num_reads, regs_read[0], regs_read[2]);
+
+  // Exception: past the end of the table
+  len = modbus_read_registers_gen(1, TABLE_SIZE - 1, 2, ADU);
+  res = _transact(ctx, client, ADU, len, &frame);
+  TEST_CHECK(res.rc == MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS && frame.fn_code == (MODBUS_FC_READ_HOLDING_REGISTERS | 0x80),
+             "framing %d: exception returned %d", framing, res.rc);
+
+  // Write, answered by an echo of the request
+  len = modbus_write_register_gen(1, 7, 0xBEEF, ADU);
+  res = _transact(ctx, client, ADU, len, &frame);
+  TEST_CHECK(res.rc == 0 && frame.fn_code == MODBUS_FC_WRITE_SINGLE_REGISTER &&
+             memcmp(frame.ADU, ADU, len) == 0, "framing %d: write returned %d", framing, res.rc);
+  TEST_CHECK(registers[7] == 0xBEEF, "framing %d: register holds 0x%04X", framing, registers[7]);
+
+  // Timeout: the slave does not answer broadcasts
+  modbus_async_set_timeout(client, 100);
+  len = modbus_write_register_gen(MODBUS_BROADCAST_ADDRESS, 8, 0x0042, ADU);
+  res = _transact(ctx, client, ADU, len, &frame);
+  TEST_CHECK(res.rc == -1 && res.err == ETIMEDOUT, "framing %d: broadcast returned %d, errno %d",
+             framing, res.rc, res.err);
+  TEST_CHECK(registers[8] == 0x0042, "framing %d: broadcast not applied", framing);
+
+  // The link is still usable after a timeout
+  len = modbus_read_registers_gen(1, 7, 1, ADU);
+  res = _transact(ctx, client, ADU, len, &frame);
+  TEST_CHECK(res.rc == 0 && regs_read[0] == 0xBEEF, "framing %d: read after timeout returned %d",
+             framing, res.rc);
+
+  modbus_async_close(client);
+  modbus_async_close(server);
+  modbus_async_free(ctx);
+}
+
+/* Accepts a link on a bare listening socket while the loop runs */
+static int _accept(modbus_async_t *ctx, int listen_fd, int timeout_ms){
+  uint64_t deadline = test_now_us() + timeout_ms * 1000ULL;
+  int fd;
+
+  while ((fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) == -1 && test_now_us() < deadline)
+    modbus_async_run(ctx, 10);
+  return fd;
+}
+
+static void _test_reconnect(int framing){
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  socklen_t addr_len = sizeof(addr);
+  int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  uint8_t bits_read[8];
+  uint16_t regs_read[8];
+  modbus_res_data_t data = { bits_read, regs_read };
+  modbus_res_frame_t frame = { .data = &data };
+  modbus_async_t *ctx = modbus_async_new(2);
+  modbus_async_conn_t *client;
+  uint8_t ADU[MODBUS_MAX_ADU_LENGTH];
+  result_t res = { 0 };
+  uint64_t t0;
+  int fd, len;
+
+  bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+  listen(listen_fd, 4);
+  getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len);
+
+  client = modbus_async_connect(ctx, "127.0.0.1", ntohs(addr.sin_port), framing);
+  fd = _accept(ctx, listen_fd, 2000);
+  TEST_CHECK(fd >= 0 && _wait_connected(ctx, client, 2000), "framing %d: not connected", framing);
+
+  // The peer goes away with a request in flight
+  len = modbus_read_registers_gen(1, 0, 1, ADU);
+  TEST_CHECK(modbus_async_submit(client, ADU, len, &frame, _on_response, &res) == 0, "submit");
+  modbus_async_run(ctx, 10);
+  close(fd);
+  TEST_CHECK(_run_until(ctx, &res.done, 2000), "framing %d: no callback after the peer closed", framing);
+  TEST_CHECK(res.rc == -1 && res.err == ECONNRESET, "framing %d: dropped link gave %d, errno %d",
+             framing, res.rc, res.err);
+  TEST_CHECK(!modbus_async_is_connected(client), "framing %d: still connected", framing);
+
+  // The link comes back by itself, after the first back off
+  t0 = test_now_us();
+  fd = _accept(ctx, listen_fd, 2000);
+  TEST_CHECK(fd >= 0 && _wait_connected(ctx, client, 2000), "framing %d: no reconnection", framing);
+  TEST_CHECK(test_now_us() - t0 >= (MODBUS_ASYNC_BACKOFF_MIN_MS - 10) * 1000ULL,
+             "framing %d: reconnected before the back off", framing);
+  close(fd);
+  modbus_async_close(client);
+
+  // Nobody listens any more: the request fails with the connect error
+  close(listen_fd);
+  client = modbus_async_connect(ctx, "127.0.0.1", ntohs(addr.sin_port), framing);
+  res.done = 0;
+  TEST_CHECK(modbus_async_submit(client, ADU, len, &frame, _on_response, &res) == 0, "submit");
+  TEST_CHECK(_run_until(ctx, &res.done, 2000), "framing %d: no callback on a refused link", framing);
+  TEST_CHECK(res.rc == -1 && res.err == ECONNREFUSED, "framing %d: refused link gave %d, errno %d",
+             framing, res.rc, res.err);
+  modbus_async_close(client);
+  modbus_async_free(ctx);
+}
+
+/* Waits for the request of the client on the peer side of the link */
+static int _peer_receive(modbus_async_t *ctx, int fd, uint8_t buf[], int size){
+  uint64_t deadline = test_now_us() + 2000000;
+  ssize_t n;
+
+  while ((n = recv(fd, buf, size, MSG_DONTWAIT)) <= 0 && test_now_us() < deadline)
+    modbus_async_run(ctx, 10);
+  return n;
+}
+
+/* Responses of a hand written peer that do not hold together */
+static void _test_bad_responses(int framing){
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  socklen_t addr_len = sizeof(addr);
+  int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  uint16_t registers[4] = { 0x1234, 0x5678 };
+  modbus_mapping_t map = { .nb_registers = 4, .tab_registers = registers };
+  uint8_t bits_read[8];
+  uint16_t regs_read[8];
+  modbus_res_data_t data = { bits_read, regs_read };
+  modbus_res_frame_t frame = { .data = &data };
+  modbus_async_t *ctx = modbus_async_new(2);
+  modbus_async_conn_t *client;
+  uint8_t ADU[MODBUS_MAX_ADU_LENGTH], req[MODBUS_MAX_ADU_LENGTH], rsp[MODBUS_MAX_ADU_LENGTH + 8];
+  result_t res;
+  int fd, len, n;
+
+  bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+  listen(listen_fd, 4);
+  getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len);
+  client = modbus_async_connect(ctx, "127.0.0.1", ntohs(addr.sin_port), framing);
+  modbus_async_set_timeout(client, 200);
+  fd = _accept(ctx, listen_fd, 2000);
+  TEST_CHECK(fd >= 0 && _wait_connected(ctx, client, 2000), "framing %d: not connected", framing);
+  len = modbus_read_registers_gen(1, 0, 2, ADU);
+
+  if (framing == MODBUS_ASYNC_TCP) {
+    static const uint8_t truncated[] = { 0, 0, 0, 5, 1, 3, 4, 0x12, 0x34 };
+    static const uint8_t whole[] = { 0, 0, 0, 7, 1, 3, 4, 0x12, 0x34, 0x56, 0x78 };
+
+    // Byte count of 4, with 2 bytes in the MBAP frame
+    res = (result_t){ 0 };
+    modbus_async_submit(client, ADU, len, &frame, _on_response, &res);
+    n = _peer_receive(ctx, fd, req, sizeof(req));
+    TEST_CHECK(n == 12, "MBAP request of %d bytes", n);
+    memcpy(rsp, req, 2);
+    memcpy(&rsp[2], truncated, sizeof(truncated));
+    send(fd, rsp, 2 + sizeof(truncated), 0);
+    TEST_CHECK(_run_until(ctx, &res.done, 2000) && res.rc == -1 && res.err == EMBBADDATA,
+               "truncated MBAP frame gave %d, errno %d, %d registers", res.rc, res.err, frame.num_reads);
+
+    // Byte count of 251, the ADU would be 256 bytes long
+    res = (result_t){ 0 };
+    modbus_async_submit(client, ADU, len, &frame, _on_response, &res);
+    n = _peer_receive(ctx, fd, req, sizeof(req));
+    memset(rsp, 0, sizeof(rsp));
+    memcpy(rsp, req, 2);
+    rsp[5] = 254;
+    rsp[6] = 1;
+    rsp[7] = 3;
+    rsp[8] = 251;
+    send(fd, rsp, 6 + 254, 0);
+    TEST_CHECK(_run_until(ctx, &res.done, 2000) && res.rc == -1 && res.err == EMBBADDATA,
+               "oversized MBAP frame gave %d, errno %d", res.rc, res.err);
+
+    // And the link still works
+    res = (result_t){ 0 };
+    modbus_async_submit(client, ADU, len, &frame, _on_response, &res);
+    n = _peer_receive(ctx, fd, req, sizeof(req));
+    memcpy(rsp, req, 2);
+    memcpy(&rsp[2], whole, sizeof(whole));
+    send(fd, rsp, 2 + sizeof(whole), 0);
+    TEST_CHECK(_run_until(ctx, &res.done, 2000) && res.rc == 0 && frame.num_reads == 2 &&
+               regs_read[0] == 0x1234 && regs_read[1] == 0x5678, "MBAP response gave %d", res.rc);
+  }
+  else {
+    // Byte count of 251: dropped as garbage, the request times out
+    res = (result_t){ 0 };
+    modbus_async_submit(client, ADU, len, &frame, _on_response, &res);
+    n = _peer_receive(ctx, fd, req, sizeof(req));
+    TEST_CHECK(n == 8, "RTU request of %d bytes", n);
+    memset(rsp, 0, sizeof(rsp));
+    rsp[0] = 1;
+    rsp[1] = 3;
+    rsp[2] = 251;
+    send(fd, rsp, 5 + 251, 0);
+    TEST_CHECK(_run_until(ctx, &res.done, 2000) && res.rc == -1 && res.err == ETIMEDOUT,
+               "oversized RTU frame gave %d, errno %d", res.rc, res.err);
+
+    res = (result_t){ 0 };
+    modbus_async_submit(client, ADU, len, &frame, _on_response, &res);
+    n = _peer_receive(ctx, fd, req, sizeof(req));
+    n = modbus_reply_gen(req, n, &map, rsp);
+    send(fd, rsp, n, 0);
+    TEST_CHECK(_run_until(ctx, &res.done, 2000) && res.rc == 0 && frame.num_reads == 2 &&
+               regs_read[0] == 0x1234 && regs_read[1] == 0x5678, "RTU response gave %d", res.rc);
+  }
+
+  close(fd);
+  close(listen_fd);
+  modbus_async_close(client);
+  modbus_async_free(ctx);
+}
+
+int main(void){
+  static const int framings[] = { MODBUS_ASYNC_RTU_OVER_TCP, MODBUS_ASYNC_TCP };
+
+  for (size_t i = 0; i < sizeof(framings) / sizeof(framings[0]); i++) {
+    _test_slave(framings[i]);
+    _test_reconnect(framings[i]);
+    _test_bad_responses(framings[i]);
+  }
+  return test_report("test-async");
+}
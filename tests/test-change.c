@@ -0,0 +1,159 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* modbus-change over register and bit ranges longer than a 16-byte chunk,
+ * so that both the SIMD compare and the scalar tail see changes, with and
+ * without deadbands.
+ */
+
+#define _GNU_SOURCE   // posix_openpt in test.h
+
+#include <string.h>
+#include <errno.h>
+
+#include "modbus.h"
+#include "modbus-tag.h"
+#include "modbus-change.h"
+#include "test.h"
+
+#define UNIT     7
+#define ADDR     100
+#define NB_REGS  20     // 40 bytes: two chunks and an 8-byte tail
+#define NB_BITS  40
+
+static uint8_t bits[NB_BITS];
+static uint16_t registers[NB_REGS];
+static modbus_res_data_t data = { bits, registers };
+
+static int _detect(modbus_change_t *ctx, uint8_t fn_code, int nb, uint16_t changed[]){
+  modbus_res_frame_t frame = { .unit = UNIT, .fn_code = fn_code, .num_reads = nb, .data = &data };
+
+  return modbus_change_detect(ctx, &frame, ADDR, changed);
+}
+
+/* Checks the offsets reported against the expected list */
+static void _expect(int count, const uint16_t changed[], const uint16_t expected[], int nb_expected,
+                    const char *what){
+  TEST_CHECK(count == nb_expected, "%s: %d changes reported, expected %d", what, count, nb_expected);
+  if (count != nb_expected)
+    return;
+  for (int i = 0; i < count; i++)
+    TEST_CHECK(changed[i] == expected[i], "%s: change #%d at %d, expected %d", what, i,
+               changed[i], expected[i]);
+}
+
+static void _test_registers(void){
+  modbus_change_t *ctx = modbus_change_new(4);
+  uint16_t changed[NB_REGS], all[NB_REGS];
+  int count;
+
+  for (int i = 0; i < NB_REGS; i++) {
+    registers[i] = 0x100 + i;
+    all[i] = i;
+  }
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, all, NB_REGS, "first response");
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, NULL, 0, "same response");
+
+  // Low byte in the first chunk, high byte in the tail
+  registers[3] ^= 0x0001;
+  registers[18] ^= 0x0100;
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, (const uint16_t[]){ 3, 18 }, 2, "chunk and tail");
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, NULL, 0, "published");
+
+  // Another quantity from the same address is another range
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, 8, changed);
+  _expect(count, changed, all, 8, "other range");
+
+  // Reset publishes everything again
+  modbus_change_reset(ctx);
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, all, NB_REGS, "after reset");
+
+  modbus_change_free(ctx);
+}
+
+static void _test_deadbands(void){
+  static const modbus_deadband_t deadbands[] = {
+    { ADDR + 0,  MODBUS_TAG_INT16,   MODBUS_ORDER_ABCD, MODBUS_DEADBAND_ABSOLUTE, 5 },
+    { ADDR + 4,  MODBUS_TAG_FLOAT32, MODBUS_ORDER_ABCD, MODBUS_DEADBAND_PERCENT,  10 },
+    { ADDR + 16, MODBUS_TAG_UINT32,  MODBUS_ORDER_CDAB, MODBUS_DEADBAND_ABSOLUTE, 1000 },
+  };
+  modbus_change_t *ctx = modbus_change_new(4);
+  uint16_t changed[NB_REGS];
+  int count;
+
+  TEST_CHECK(modbus_change_set_deadbands(ctx, UNIT, MODBUS_FC_READ_HOLDING_REGISTERS, ADDR, NB_REGS,
+                                         deadbands, 3) == 0, "set_deadbands: %s", strerror(errno));
+  TEST_CHECK(modbus_change_set_deadbands(ctx, UNIT, MODBUS_FC_READ_HOLDING_REGISTERS, ADDR, 4,
+                                         deadbands, 3) == -1 && errno == EINVAL,
+             "deadband outside of its range accepted");
+
+  memset(registers, 0, sizeof(registers));
+  registers[0] = 20;
+  modbus_set_float_abcd(100.0f, &registers[4]);
+  modbus_set_uint32(50000, &registers[16], MODBUS_ORDER_CDAB);
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  TEST_CHECK(count == NB_REGS, "first response with deadbands: %d changes", count);
+
+  // Absolute: +3 stays in the band, a second +3 is 6 away from what was published
+  registers[0] = 23;
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, NULL, 0, "absolute, in the band");
+  registers[0] = 26;
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, (const uint16_t[]){ 0 }, 1, "absolute, drifted out of the band");
+
+  // Percent: 100.5 is in 10% of 100, 120 is not. Either moves the first
+  // register only, the value is reported whole.
+  modbus_set_float_abcd(100.5f, &registers[4]);
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, NULL, 0, "percent, in the band");
+  modbus_set_float_abcd(120.0f, &registers[4]);
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, (const uint16_t[]){ 4, 5 }, 2, "percent, out of the band");
+
+  // A 32-bit value in the tail, with a register without deadband next to it
+  modbus_set_uint32(50999, &registers[16], MODBUS_ORDER_CDAB);
+  registers[19] = 1;
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, (const uint16_t[]){ 19 }, 1, "tail, in the band");
+  modbus_set_uint32(51001, &registers[16], MODBUS_ORDER_CDAB);
+  count = _detect(ctx, MODBUS_FC_READ_HOLDING_REGISTERS, NB_REGS, changed);
+  _expect(count, changed, (const uint16_t[]){ 16, 17 }, 2, "tail, out of the band");
+
+  modbus_change_free(ctx);
+}
+
+static void _test_bits(void){
+  modbus_change_t *ctx = modbus_change_new(4);
+  uint16_t changed[NB_BITS];
+  int count;
+
+  TEST_CHECK(modbus_change_set_deadbands(ctx, UNIT, MODBUS_FC_READ_COILS, ADDR, NB_BITS, NULL, 0) == -1 &&
+             errno == EINVAL, "deadbands on bits accepted");
+
+  memset(bits, 0, sizeof(bits));
+  count = _detect(ctx, MODBUS_FC_READ_COILS, NB_BITS, changed);
+  TEST_CHECK(count == NB_BITS, "first bits: %d changes", count);
+  bits[5] = 1;
+  bits[37] = 1;
+  count = _detect(ctx, MODBUS_FC_READ_COILS, NB_BITS, changed);
+  _expect(count, changed, (const uint16_t[]){ 5, 37 }, 2, "bits");
+  // Discrete inputs of the same addresses are another range
+  count = _detect(ctx, MODBUS_FC_READ_DISCRETE_INPUTS, NB_BITS, changed);
+  TEST_CHECK(count == NB_BITS, "first discrete inputs: %d changes", count);
+
+  modbus_change_free(ctx);
+}
+
+int main(void){
+  _test_registers();
+  _test_deadbands();
+  _test_bits();
+  return test_report("test-change");
+}
@@ -0,0 +1,69 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* modbus.hpp: every compile-time builder gives the frame of the matching
+ * modbus_xxx_gen function, byte for byte.
+ */
+
+#ifndef _GNU_SOURCE   // set by g++ already
+#define _GNU_SOURCE   // posix_openpt in test.h
+#endif
+
+#include <cstring>
+
+#include "modbus.hpp"
+#include "test.h"
+
+/* Compares a compile-time frame with the one of the C generator */
+template <std::size_t N>
+static void _expect(const std::array<uint8_t, N> &frame, const uint8_t ADU[], int len, const char *what){
+  TEST_CHECK(len == (int)N, "%s: %zu bytes, modbus_xxx_gen gave %d", what, N, len);
+  if (len == (int)N)
+    TEST_CHECK(std::memcmp(frame.data(), ADU, N) == 0, "%s: frames differ", what);
+}
+
+int main(void){
+  uint8_t ADU[MODBUS_MAX_ADU_LENGTH];
+  int len;
+
+  // Evaluated by the compiler, CRC included
+  static constexpr auto poll = modbus::read_registers<0x01, 0x0100, 10>();
+  static_assert(poll.size() == 8 && modbus::crc16(poll.data(), poll.size()) == 0, "CRC not computed at compile time");
+
+  len = modbus_read_registers_gen(0x01, 0x0100, 10, ADU);
+  _expect(poll, ADU, len, "read_registers");
+
+  len = modbus_read_input_registers_gen(0x11, 0xFFFF, MODBUS_MAX_READ_REGISTERS, ADU);
+  _expect(modbus::read_input_registers<0x11, 0xFFFF, MODBUS_MAX_READ_REGISTERS>(), ADU, len,
+          "read_input_registers");
+
+  len = modbus_read_bits_gen(0x02, 0x0013, 37, ADU);
+  _expect(modbus::read_bits<0x02, 0x0013, 37>(), ADU, len, "read_bits");
+
+  len = modbus_read_input_bits_gen(0xF7, 0x00C4, 22, ADU);
+  _expect(modbus::read_input_bits<0xF7, 0x00C4, 22>(), ADU, len, "read_input_bits");
+
+  len = modbus_write_bit_gen(0x03, 0x00AC, 1, ADU);
+  _expect(modbus::write_bit<0x03, 0x00AC, true>(), ADU, len, "write_bit on");
+  len = modbus_write_bit_gen(0x03, 0x00AC, 0, ADU);
+  _expect(modbus::write_bit<0x03, 0x00AC, false>(), ADU, len, "write_bit off");
+
+  len = modbus_write_register_gen(0x04, 0x0001, 0xABCD, ADU);
+  _expect(modbus::write_register<0x04, 0x0001, 0xABCD>(), ADU, len, "write_register");
+
+  // 10 bits: a second, partial byte
+  static const uint8_t bits[] = { 1, 0, 1, 1, 0, 0, 1, 1, 1, 0 };
+  len = modbus_write_bits_gen(0x05, 0x0013, 10, bits, ADU);
+  _expect(modbus::write_bits<0x05, 0x0013, 1, 0, 1, 1, 0, 0, 1, 1, 1, 0>(), ADU, len, "write_bits");
+
+  static const uint16_t values[] = { 0x000A, 0x0102, 0xFFFF };
+  len = modbus_write_registers_gen(0x06, 0x0001, 3, values, ADU);
+  _expect(modbus::write_registers<0x06, 0x0001, 0x000A, 0x0102, 0xFFFF>(), ADU, len, "write_registers");
+
+  // Receive buffers sized by the header hold the generated replies
+  static_assert(modbus::read_bits_response_length<37> == 5 + 5, "bits response length");
+  static_assert(modbus::read_registers_response_length<10> == 5 + 20, "registers response length");
+
+  return test_report("test-hpp");
+}
@@ -0,0 +1,88 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* modbus-image: a reader keeps a working mapping when the poller recreates
+ * the image with another layout, and sees the new one once it reopens.
+ */
+
+#define _GNU_SOURCE   // posix_openpt in test.h
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "modbus.h"
+#include "modbus-image.h"
+#include "test.h"
+
+static void _test_recreate(const char *name){
+  static const modbus_image_region_t large[] = {
+    { 1, MODBUS_FC_READ_HOLDING_REGISTERS, 0, 200 },
+    { 2, MODBUS_FC_READ_INPUT_REGISTERS, 100, 50 },
+  };
+  static const modbus_image_region_t small[] = {
+    { 1, MODBUS_FC_READ_HOLDING_REGISTERS, 0, 10 },
+  };
+  modbus_image_t *writer, *reader;
+  uint16_t values[50], read[50];
+
+  for (int i = 0; i < 50; i++)
+    values[i] = 0x4000 + i;
+  writer = modbus_image_create(name, large, 2);
+  TEST_CHECK(writer != NULL, "create: %s", strerror(errno));
+  if (writer == NULL)
+    return;
+  modbus_image_write(writer, 2, MODBUS_FC_READ_INPUT_REGISTERS, 100, 50, values);
+  reader = modbus_image_open(name);
+  TEST_CHECK(reader != NULL, "open: %s", strerror(errno));
+  if (reader == NULL)
+    return;
+
+  // Smaller image under the same name: the old mapping stays readable to its end
+  modbus_image_close(writer);
+  writer = modbus_image_create(name, small, 1);
+  TEST_CHECK(writer != NULL, "recreate: %s", strerror(errno));
+  TEST_CHECK(modbus_image_read(reader, 2, MODBUS_FC_READ_INPUT_REGISTERS, 100, 50, read) == 0 &&
+             memcmp(read, values, sizeof(values)) == 0, "old image lost its values");
+  modbus_image_close(reader);
+
+  reader = modbus_image_open(name);
+  TEST_CHECK(reader != NULL, "reopen: %s", strerror(errno));
+  TEST_CHECK(modbus_image_read(reader, 2, MODBUS_FC_READ_INPUT_REGISTERS, 100, 1, read) == -1 &&
+             errno == EMBXILADD, "region of the old image still found");
+  modbus_image_write(writer, 1, MODBUS_FC_READ_HOLDING_REGISTERS, 0, 10, values);
+  TEST_CHECK(modbus_image_read(reader, 1, MODBUS_FC_READ_HOLDING_REGISTERS, 0, 10, read) == 0 &&
+             memcmp(read, values, 10 * sizeof(uint16_t)) == 0, "new image not shared");
+
+  modbus_image_close(reader);
+  modbus_image_close(writer);
+}
+
+/* An object the writer has not finished yet */
+static void _test_unfinished(const char *name){
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+
+  TEST_CHECK(fd != -1, "shm_open: %s", strerror(errno));
+  if (fd == -1)
+    return;
+  TEST_CHECK(modbus_image_open(name) == NULL && errno == EAGAIN, "empty object opened, errno %d", errno);
+  // Sized, but without its magic
+  TEST_CHECK(ftruncate(fd, 4096) == 0, "ftruncate: %s", strerror(errno));
+  TEST_CHECK(modbus_image_open(name) == NULL && errno == EAGAIN, "image without magic opened, errno %d", errno);
+  close(fd);
+  modbus_image_unlink(name);
+}
+
+int main(void){
+  char name[64];
+
+  snprintf(name, sizeof(name), "/modbus-test-image-%d", (int)getpid());
+  _test_unfinished(name);
+  _test_recreate(name);
+  modbus_image_unlink(name);
+  return test_report("test-image");
+}
@@ -0,0 +1,262 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* modbus-sched against simulated slaves behind a pseudo terminal. The
+ * child process plays the serial line and the slaves: it holds each answer
+ * back for the wire time of both frames plus the slave latency, so the
+ * scheduler sees the timing of a real 115200 bps line.
+ *
+ *   unit 1  answers after 10 ms
+ *   unit 2  answers after 20 ms
+ *   unit 3  ignores its first DEAD_POLLS requests, then answers after 5 ms
+ */
+
+#define _GNU_SOURCE   // posix_openpt, ptsname, cfmakeraw
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "modbus.h"
+#include "modbus-sched.h"
+#include "test.h"
+
+#define BAUD          115200
+#define DEAD_POLLS    3
+#define TABLE_SIZE    64
+
+static const uint32_t slave_latency_us[] = { 0, 10000, 20000, 5000 };
+
+static void _slaves_run(int fd){
+  uint8_t bits[TABLE_SIZE] = { 0 }, input_bits[TABLE_SIZE] = { 0 };
+  uint16_t registers[TABLE_SIZE] = { 0 }, input_registers[TABLE_SIZE] = { 0 };
+  modbus_mapping_t map = {
+    .nb_bits = TABLE_SIZE, .nb_input_bits = TABLE_SIZE,
+    .nb_input_registers = TABLE_SIZE, .nb_registers = TABLE_SIZE,
+    .tab_bits = bits, .tab_input_bits = input_bits,
+    .tab_input_registers = input_registers, .tab_registers = registers
+  };
+  modbus_sched_t line;
+  modbus_poll_job_t unused;
+  uint8_t req[8], rsp[MODBUS_MAX_ADU_LENGTH];
+  int unit3_polls = 0;
+
+  // Only for its wire timing model
+  modbus_sched_init(&line, BAUD, 0, &unused, 1);
+
+  for (;;) {
+    uint64_t rx_us;
+    int len = 0, rsp_len;
+
+    // Every request here is a read, 8 bytes long
+    while (len < (int)sizeof(req)) {
+      ssize_t n = read(fd, &req[len], sizeof(req) - len);
+      if (n <= 0)
+        _exit(0);
+      len += n;
+    }
+    rx_us = test_now_us();
+    if (req[0] == 3 && unit3_polls++ < DEAD_POLLS)
+      continue;
+
+    rsp_len = modbus_reply_gen(req, len, &map, rsp);
+    test_sleep_until_us(rx_us + modbus_sched_wire_us(&line, len) + slave_latency_us[req[0]] +
+                        modbus_sched_wire_us(&line, rsp_len));
+    if (write(fd, rsp, rsp_len) != rsp_len)
+      _exit(1);
+  }
+}
+
+/* Waits for a whole response until deadline_us. Returns its length with
+ * the arrival of its last byte in rx_us, 0 on timeout.
+ */
+static int _receive(int fd, uint8_t rsp[], uint64_t deadline_us, uint64_t *rx_us){
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  int len = 0;
+
+  for (;;) {
+    int need = modbus_ADU_length(rsp, len);
+    uint64_t now = test_now_us();
+    ssize_t n;
+
+    if (need > 0 && len >= need) {
+      *rx_us = now;
+      return len;
+    }
+    if (now >= deadline_us || poll(&pfd, 1, (deadline_us - now + 999) / 1000) <= 0)
+      return 0;
+    n = read(fd, &rsp[len], (need > 0 ? need : 3) - len);
+    if (n <= 0)
+      return 0;
+    len += n;
+  }
+}
+
+/* Throws away a late answer, so it is not taken for the next one */
+static void _drain(int fd, int ms){
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  uint8_t junk[MODBUS_MAX_ADU_LENGTH];
+
+  while (poll(&pfd, 1, ms) > 0) {
+    if (read(fd, junk, sizeof(junk)) <= 0)
+      return;
+  }
+}
+
+/* The job handed out must have the earliest deadline of the ready ones */
+static void _check_edf(const modbus_sched_t *sched, int best, uint64_t t){
+  const modbus_poll_job_t *b = &sched->jobs[best];
+
+  for (int i = 0; i < sched->nb_jobs; i++) {
+    const modbus_poll_job_t *j = &sched->jobs[i];
+    if (i == best || j->release_us > t || sched->slaves[j->unit].backoff_until_us > t)
+      continue;
+    TEST_CHECK(b->deadline_us < j->deadline_us ||
+               (b->deadline_us == j->deadline_us && b->priority <= j->priority),
+               "job %d (deadline %llu) picked before job %d (deadline %llu)", best,
+               (unsigned long long)b->deadline_us, i, (unsigned long long)j->deadline_us);
+  }
+}
+
+static void _test_timing_model(void){
+  modbus_sched_t sched;
+  modbus_poll_job_t jobs[1];
+
+  // 3.5 characters of 11 bits at 9600 bps, rounded up
+  modbus_sched_init(&sched, 9600, 0, jobs, 1);
+  TEST_CHECK(sched.t35_us == 4011, "t35 at 9600 bps is %u us", sched.t35_us);
+  TEST_CHECK(modbus_sched_wire_us(&sched, 8) == 9167, "8 bytes at 9600 bps take %u us",
+             modbus_sched_wire_us(&sched, 8));
+  // Fixed interval above 19200 bps
+  modbus_sched_init(&sched, BAUD, 0, jobs, 1);
+  TEST_CHECK(sched.t35_us == MODBUS_RTU_T35_FIXED_US, "t35 at %d bps is %u us", BAUD, sched.t35_us);
+}
+
+static void _test_line(int fd){
+  modbus_sched_t sched;
+  modbus_poll_job_t jobs[4];
+  uint8_t req[MODBUS_MAX_ADU_LENGTH], rsp[MODBUS_MAX_ADU_LENGTH];
+  int order[4], nb_picks = 0;
+  int answers[4] = { 0 };
+  uint32_t backoff[DEAD_POLLS];
+  int unit3_timeouts = 0, unit3_answered = 0;
+  int late = 0;           // healthy slaves that missed their timeout, on a loaded host
+  uint64_t bus_free = 0, start = test_now_us();
+
+  modbus_sched_init(&sched, BAUD, 0, jobs, 4);
+  // Ties on deadline go to priority: job 0 before job 1
+  modbus_sched_add(&sched, 1, MODBUS_FC_READ_HOLDING_REGISTERS, 0, 10, 100000, 0, start);
+  modbus_sched_add(&sched, 2, MODBUS_FC_READ_INPUT_REGISTERS, 0, 10, 100000, 1, start);
+  modbus_sched_add(&sched, 1, MODBUS_FC_READ_COILS, 0, 16, 120000, 0, start);
+  modbus_sched_add(&sched, 3, MODBUS_FC_READ_HOLDING_REGISTERS, 0, 4, 140000, 0, start);
+
+  while (!unit3_answered || answers[1] < 16 || answers[2] < 8) {
+    uint64_t tx_us, rx_us, now, unused;
+    int job, len, unit;
+
+    TEST_CHECK(test_now_us() - start < 5000000, "no progress");
+    if (test_failures)
+      return;
+
+    job = modbus_sched_next(&sched, test_now_us(), req, &tx_us);
+    if (job == -1) {
+      TEST_CHECK(errno == EAGAIN, "modbus_sched_next: %s", strerror(errno));
+      test_sleep_until_us(tx_us);
+      continue;
+    }
+    TEST_CHECK(modbus_sched_next(&sched, tx_us, req, &unused) == -1 && errno == EBUSY,
+               "second request while one is in flight");
+
+    unit = jobs[job].unit;
+    _check_edf(&sched, job, tx_us);
+    if (nb_picks < 4)
+      order[nb_picks++] = job;
+    // Silent interval after the previous frame
+    TEST_CHECK(tx_us >= bus_free, "request at %llu, line busy until %llu",
+               (unsigned long long)tx_us, (unsigned long long)bus_free);
+    if (unit == 3 && unit3_timeouts > 0)
+      TEST_CHECK(tx_us >= sched.slaves[3].backoff_until_us, "unit 3 polled during its back off");
+
+    test_sleep_until_us(tx_us);
+    now = test_now_us();
+    modbus_sched_sent(&sched, job, now);
+    TEST_CHECK(write(fd, req, 8) == 8, "write: %s", strerror(errno));
+
+    len = _receive(fd, rsp, now + modbus_sched_timeout_us(&sched, job), &rx_us);
+    if (len == 0) {
+      now = test_now_us();
+      modbus_sched_timeout(&sched, job, now);
+      bus_free = now + sched.t35_us;
+      if (unit != 3) {
+        late++;
+        _drain(fd, 50);
+      }
+      if (unit == 3 && unit3_timeouts < DEAD_POLLS) {
+        backoff[unit3_timeouts++] = sched.slaves[3].backoff_us;
+        TEST_CHECK(sched.slaves[3].timeouts == unit3_timeouts, "%d timeouts counted for %d",
+                   sched.slaves[3].timeouts, unit3_timeouts);
+        TEST_CHECK(sched.slaves[3].backoff_until_us == now + sched.slaves[3].backoff_us,
+                   "back off not counted from the timeout");
+      }
+      continue;
+    }
+
+    TEST_CHECK(len == modbus_sched_rsp_len(&jobs[job]), "unit %d answered %d bytes", unit, len);
+    modbus_sched_done(&sched, job, rx_us);
+    bus_free = rx_us + sched.t35_us;
+    answers[unit]++;
+    if (unit == 3) {
+      unit3_answered = 1;
+      // One answer clears the back off
+      TEST_CHECK(sched.slaves[3].backoff_us == 0 && sched.slaves[3].backoff_until_us == 0 &&
+                 sched.slaves[3].timeouts == 0, "back off not reset after an answer");
+    }
+  }
+
+  TEST_CHECK(order[0] == 0 && order[1] == 1 && order[2] == 2 && order[3] == 3,
+             "first picks %d %d %d %d, expected by deadline then priority",
+             order[0], order[1], order[2], order[3]);
+  TEST_CHECK(late <= 2, "%d timeouts of slaves that answer", late);
+  TEST_CHECK(unit3_timeouts == DEAD_POLLS, "unit 3 timed out %d times", unit3_timeouts);
+  for (int i = 0; i < unit3_timeouts; i++) {
+    TEST_CHECK(backoff[i] == MODBUS_SCHED_BACKOFF_MIN_US << i, "back off %d is %u us",
+               i, backoff[i]);
+  }
+  // The estimate tracks the turnaround once the wire time is taken out. The
+  // child oversleeps on a loaded host, so only the low bound is tight.
+  for (int unit = 1; unit <= 2; unit++) {
+    uint32_t latency = sched.slaves[unit].latency_us;
+    TEST_CHECK(latency >= slave_latency_us[unit] - 500 &&
+               latency <= slave_latency_us[unit] * 3 / 2 + 5000,
+               "unit %d latency estimated at %u us, simulated %u us",
+               unit, latency, slave_latency_us[unit]);
+  }
+}
+
+int main(void){
+  int slave_fd, fd;
+  pid_t child;
+
+  _test_timing_model();
+
+  fd = test_pty_open(&slave_fd);
+  if (fd == -1)
+    return 1;
+  child = fork();
+  if (child == 0) {
+    close(fd);
+    _slaves_run(slave_fd);
+  }
+  close(slave_fd);
+
+  _test_line(fd);
+
+  kill(child, SIGTERM);
+  waitpid(child, NULL, 0);
+  close(fd);
+  return test_report("test-sched");
+}
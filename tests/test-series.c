@@ -0,0 +1,150 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* modbus-series scans, with readers that follow the appends: each scan is
+ * checked against a plain copy of the samples.
+ */
+
+#define _GNU_SOURCE   // posix_openpt in test.h
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "modbus.h"
+#include "modbus-series.h"
+#include "test.h"
+
+#define UNIT        1
+#define FC          MODBUS_FC_READ_HOLDING_REGISTERS
+#define ADDR        100
+#define MAX_SAMPLES (4 * MODBUS_SERIES_BLOCK_SAMPLES)
+
+typedef struct sample_t {
+    uint64_t t_ms;
+    uint16_t value;
+} sample_t;
+
+static sample_t samples[MAX_SAMPLES];
+static int nb_samples;
+
+static void _append(modbus_series_store_t *store, uint64_t t_ms, uint16_t value){
+  TEST_CHECK(modbus_series_append(store, UNIT, FC, ADDR, t_ms, value) == 0, "append at %llu",
+             (unsigned long long)t_ms);
+  samples[nb_samples].t_ms = t_ms;
+  samples[nb_samples].value = value;
+  nb_samples++;
+}
+
+/* Reads what the reader has, and checks it against the samples from *next on */
+static void _follow(modbus_series_reader_t *reader, uint64_t from_ms, uint64_t to_ms, uint16_t lo, uint16_t hi,
+                    int *next, const char *what){
+  uint64_t t;
+  uint16_t v;
+
+  while (modbus_series_next(reader, &t, &v)) {
+    while (*next < nb_samples && (samples[*next].t_ms < from_ms || samples[*next].t_ms > to_ms ||
+                                  samples[*next].value < lo || samples[*next].value > hi))
+      (*next)++;
+    TEST_CHECK(*next < nb_samples, "%s: extra sample t=%llu v=%u", what, (unsigned long long)t, v);
+    if (*next >= nb_samples)
+      return;
+    TEST_CHECK(t == samples[*next].t_ms && v == samples[*next].value,
+               "%s: read t=%llu v=%u, expected t=%llu v=%u", what, (unsigned long long)t, v,
+               (unsigned long long)samples[*next].t_ms, samples[*next].value);
+    (*next)++;
+  }
+  while (*next < nb_samples && (samples[*next].t_ms < from_ms || samples[*next].t_ms > to_ms ||
+                                samples[*next].value < lo || samples[*next].value > hi))
+    (*next)++;
+  TEST_CHECK(*next == nb_samples, "%s: sample t=%llu v=%u missed", what,
+             (unsigned long long)samples[*next].t_ms, samples[*next].value);
+}
+
+/* The reader starts before the samples it wants exist */
+static void _test_follow_future(void){
+  modbus_series_store_t *store = modbus_series_new(4);
+  modbus_series_reader_t reader;
+  int next = 0;
+
+  nb_samples = 0;
+  for (int i = 0; i < 10; i++)
+    _append(store, i * 1000, i);
+  modbus_series_scan(store, UNIT, FC, ADDR, 20000, UINT64_MAX, 0, 0xFFFF, &reader);
+  _follow(&reader, 20000, UINT64_MAX, 0, 0xFFFF, &next, "future");
+
+  for (int i = 20; i < 30; i++)
+    _append(store, i * 1000, i);
+  _follow(&reader, 20000, UINT64_MAX, 0, 0xFFFF, &next, "future");
+  TEST_CHECK(next == nb_samples, "future: stopped at %d", next);
+
+  modbus_series_free(store);
+}
+
+/* The open block does not match the value filter yet, then does */
+static void _test_follow_values(void){
+  modbus_series_store_t *store = modbus_series_new(4);
+  modbus_series_reader_t reader;
+  int next = 0;
+
+  nb_samples = 0;
+  for (int i = 0; i < 10; i++)
+    _append(store, i * 1000, 10 + i);
+  modbus_series_scan(store, UNIT, FC, ADDR, 0, UINT64_MAX, 500, 600, &reader);
+  _follow(&reader, 0, UINT64_MAX, 500, 600, &next, "values");
+
+  for (int i = 10; i < 20; i++)
+    _append(store, i * 1000, 495 + i);
+  _follow(&reader, 0, UINT64_MAX, 500, 600, &next, "values");
+  for (int i = 20; i < 30; i++)
+    _append(store, i * 1000, 600 + i);
+  _follow(&reader, 0, UINT64_MAX, 500, 600, &next, "values");
+
+  modbus_series_free(store);
+}
+
+/* Random walk over several blocks, read in slices as it is written, through
+ * filters that skip whole sealed blocks
+ */
+static void _test_follow_blocks(void){
+  static const struct { uint64_t from_ms, to_ms; uint16_t lo, hi; } scans[] = {
+    { 0, UINT64_MAX, 0, 0xFFFF },
+    { 1500000, 3000000, 0, 0xFFFF },
+    { 0, UINT64_MAX, 30000, 31000 },
+    { 2000000, UINT64_MAX, 0, 100 },
+  };
+  modbus_series_store_t *store = modbus_series_new(4);
+  modbus_series_reader_t readers[4];
+  int next[4] = { 0 };
+  uint64_t t = 0;
+  uint16_t v = 30000;
+
+  srand(1);
+  nb_samples = 0;
+  _append(store, t, v);
+  for (int i = 0; i < 4; i++)
+    modbus_series_scan(store, UNIT, FC, ADDR, scans[i].from_ms, scans[i].to_ms, scans[i].lo, scans[i].hi,
+                       &readers[i]);
+
+  while (nb_samples < MAX_SAMPLES && !test_failures) {
+    t += 900 + rand() % 200;
+    // Drifts down to 0 after 2/3 of the samples
+    v = nb_samples > MAX_SAMPLES * 2 / 3 ? (v > 50 ? v - 50 : rand() % 50) : v + rand() % 21 - 10;
+    _append(store, t, v);
+    if (rand() % 100 == 0) {
+      for (int i = 0; i < 4; i++)
+        _follow(&readers[i], scans[i].from_ms, scans[i].to_ms, scans[i].lo, scans[i].hi, &next[i], "blocks");
+    }
+  }
+  for (int i = 0; i < 4; i++)
+    _follow(&readers[i], scans[i].from_ms, scans[i].to_ms, scans[i].lo, scans[i].hi, &next[i], "blocks");
+
+  modbus_series_free(store);
+}
+
+int main(void){
+  _test_follow_future();
+  _test_follow_values();
+  _test_follow_blocks();
+  return test_report("test-series");
+}
@@ -0,0 +1,103 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* modbus-tag decode plans, into doubles and into native struct fields, for
+ * every type in every byte order. Registers are written by the setters of
+ * modbus-data.
+ */
+
+#define _GNU_SOURCE   // posix_openpt in test.h
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#include "modbus.h"
+#include "modbus-tag.h"
+#include "test.h"
+
+#define BASE  1000
+
+typedef struct record_t {
+    int16_t  temperature;     // raw
+    double   temperature_c;   // same register, scaled
+    uint16_t spare;           // no tag
+    uint16_t status;
+    int32_t  position;
+    uint32_t counter;
+    int64_t  energy;
+    float    flow;
+    double   total;
+} record_t;
+
+static const int64_t energy = (1LL << 60) + 1;   // not a double
+
+static void _test_order(modbus_byte_order_t order){
+  // Scaled and native tags of a type mixed in the schema
+  modbus_tag_t tags[] = {
+    { BASE + 0,  MODBUS_TAG_INT16,   order, 0.1, -40, offsetof(record_t, temperature_c) },
+    { BASE + 0,  MODBUS_TAG_INT16,   order, 1,   0,   offsetof(record_t, temperature) },
+    { BASE + 1,  MODBUS_TAG_UINT16,  order, 1,   0,   offsetof(record_t, status) },
+    { BASE + 2,  MODBUS_TAG_INT32,   order, 1,   0,   offsetof(record_t, position) },
+    { BASE + 4,  MODBUS_TAG_UINT32,  order, 1,   0,   offsetof(record_t, counter) },
+    { BASE + 6,  MODBUS_TAG_INT64,   order, 1,   0,   offsetof(record_t, energy) },
+    { BASE + 10, MODBUS_TAG_FLOAT32, order, 1,   0,   offsetof(record_t, flow) },
+    { BASE + 12, MODBUS_TAG_FLOAT64, order, 1,   0,   offsetof(record_t, total) },
+  };
+  const int nb_tags = sizeof(tags) / sizeof(tags[0]);
+  modbus_decode_op_t ops[sizeof(tags) / sizeof(tags[0])];
+  modbus_decode_plan_t plan;
+  uint16_t regs[2 + 16];
+  double values[sizeof(tags) / sizeof(tags[0])];
+  record_t rec;
+
+  // Two spare registers in front: the plan starts at regs[2]
+  memset(regs, 0, sizeof(regs));
+  // 16-bit values only have their bytes swapped
+  regs[2] = (uint16_t)-250;
+  regs[3] = 0xBEEF;
+  if (order == MODBUS_ORDER_DCBA || order == MODBUS_ORDER_BADC) {
+    regs[2] = (uint16_t)(regs[2] << 8 | regs[2] >> 8);
+    regs[3] = 0xEFBE;
+  }
+  modbus_set_int32(-123456789, &regs[4], order);
+  modbus_set_uint32(4000000000u, &regs[6], order);
+  modbus_set_int64(energy, &regs[8], order);
+  modbus_set_float_array((const float[]){ 1.5f }, &regs[12], 1, order);
+  modbus_set_double(-2.25e10, &regs[14], order);
+
+  TEST_CHECK(modbus_decode_plan_compile(&plan, tags, nb_tags, ops) == 0, "compile: %s", strerror(errno));
+  TEST_CHECK(plan.addr == BASE && plan.nb == 16, "plan reads %u+%u", plan.addr, plan.nb);
+  TEST_CHECK(plan.struct_size == offsetof(record_t, total) + sizeof(double) &&
+             plan.struct_size <= sizeof(record_t), "struct size %u", plan.struct_size);
+
+  // Into doubles: the 64-bit integer is rounded
+  TEST_CHECK(modbus_decode_plan_run(&plan, regs, BASE - 2, 18, values) == 0, "run: %s", strerror(errno));
+  TEST_CHECK(values[0] == -250 * 0.1 - 40 && values[1] == -250 && values[2] == 0xBEEF &&
+             values[3] == -123456789 && values[4] == 4000000000.0 && values[5] == (double)energy &&
+             values[6] == 1.5 && values[7] == -2.25e10, "order %d: doubles %g %g %g %g %g %g %g %g", order,
+             values[0], values[1], values[2], values[3], values[4], values[5], values[6], values[7]);
+
+  // Into the struct: native types, exact
+  memset(&rec, 0x5A, sizeof(rec));
+  TEST_CHECK(modbus_decode_plan_run_struct(&plan, regs, BASE - 2, 18, &rec, sizeof(rec)) == 0,
+             "run_struct: %s", strerror(errno));
+  TEST_CHECK(rec.temperature_c == -250 * 0.1 - 40 && rec.status == 0xBEEF && rec.position == -123456789 &&
+             rec.counter == 4000000000u && rec.energy == energy && rec.flow == 1.5f && rec.total == -2.25e10,
+             "order %d: struct %g %u %d %u %lld %g %g", order, rec.temperature_c, rec.status,
+             rec.position, rec.counter, (long long)rec.energy, rec.flow, rec.total);
+  TEST_CHECK(rec.temperature == -250, "order %d: raw int16 %d", order, rec.temperature);
+  TEST_CHECK(rec.spare == 0x5A5A, "field of no tag written");
+
+  TEST_CHECK(modbus_decode_plan_run_struct(&plan, regs, BASE - 2, 18, &rec, plan.struct_size - 1) == -1 &&
+             errno == EINVAL, "struct too small accepted");
+  TEST_CHECK(modbus_decode_plan_run_struct(&plan, regs, BASE, 15, &rec, sizeof(rec)) == -1 &&
+             errno == EMBBADDATA, "missing register accepted");
+}
+
+int main(void){
+  for (int order = 0; order < MODBUS_ORDER_MAX; order++)
+    _test_order(order);
+  return test_report("test-tag");
+}
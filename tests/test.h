@@ -0,0 +1,75 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_TEST_H
+#define MODBUS_TEST_H
+
+/* Helpers shared by the tests under tests/, see tests/run-tests.sh.
+ * A test is a program that returns 0 when every check passed.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+
+static int test_failures;
+
+#define TEST_CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            test_failures++; \
+            fprintf(stderr, "%s:%d: FAILED %s: ", __FILE__, __LINE__, #cond); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+        } \
+    } while (0)
+
+static inline uint64_t test_now_us(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline void test_sleep_until_us(uint64_t t_us){
+  uint64_t now = test_now_us();
+  struct timespec ts;
+
+  if (t_us > now) {
+    ts.tv_sec = (t_us - now) / 1000000;
+    ts.tv_nsec = (t_us - now) % 1000000 * 1000;
+    nanosleep(&ts, NULL);
+  }
+}
+
+/* Opens a pseudo terminal pair in raw mode, as a serial line would be.
+ * Returns the master side, the slave side in *slave_fd, -1 on error.
+ */
+static inline int test_pty_open(int *slave_fd){
+  struct termios tio;
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (fd == -1 || grantpt(fd) == -1 || unlockpt(fd) == -1 ||
+      (*slave_fd = open(ptsname(fd), O_RDWR | O_NOCTTY)) == -1) {
+    perror("pty");
+    return -1;
+  }
+  // Raw before anything is sent, or the line discipline eats bytes
+  tcgetattr(*slave_fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(*slave_fd, TCSANOW, &tio);
+  return fd;
+}
+
+static inline int test_report(const char *name){
+  if (test_failures)
+    fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures);
+  else
+    printf("%s: ok\n", name);
+  return test_failures ? 1 : 0;
+}
+
+#endif  /* MODBUS_TEST_H */
@@ -0,0 +1,713 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Differential harness. Keeps a frozen copy of the scalar code the
+ * library shipped with (_calc_CRC, modbus_write_bits_gen,
+ * modbus_ADU_parser) and checks that what the library does today gives the
+ * very same bytes, return values and errno, over every length, every nb up
+ * to the limits, then millions of random, truncated and corrupted inputs.
+ * The array conversions of modbus-data are checked against the per-value
+ * getters and setters the same way.
+ *
+ * Each kernel is then timed against its reference. A fast path may only
+ * be enabled once this runs clean with the flags of the production build:
+ *   cc -O2 -DMODBUS_DEBUG=0 -Iinc tools/modbus-diff.c src/modbus.c src/modbus-data.c -o modbus-diff
+ * (on x86 the SSSE3 path is picked at run time, no extra flag needed)
+ *
+ * Usage: modbus-diff [-n iterations] [-r seed]
+ * Exit status is non-zero on the first mismatch, which gets dumped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "modbus.h"
+#include "modbus-rtu-private.h"
+
+#if MODBUS_DEBUG
+#error "build with -DMODBUS_DEBUG=0, corrupted frames would flood stderr"
+#endif
+#if !MODBUS_WITH_READ_BITS || !MODBUS_WITH_READ_REGISTERS || !MODBUS_WITH_WRITE
+#error "modbus-diff needs every function code"
+#endif
+
+#define GUARD       16      // the parser may read before ADU[] on a wrapped ADU_len
+#define ARENA_SIZE  (GUARD + 512)
+#define BENCH_POOL  1024
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+static volatile uint32_t sink;
+
+static uint64_t _rand(void){
+  // xorshift64*
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void _rand_fill(uint8_t *buf, size_t len){
+  for (size_t i = 0; i < len; i++)
+    buf[i] = (uint8_t)_rand();
+}
+
+static uint64_t _now_ns(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _dump(const char *what, const void *buf, int len){
+  const uint8_t *p = buf;
+  fprintf(stderr, "  %-10s", what);
+  for (int i = 0; i < len; i++)
+    fprintf(stderr, "%02X", p[i]);
+  fprintf(stderr, "\n");
+}
+
+/* Reference: the scalar code as first released, diagnostics left out.
+ * Do not touch, it is what the library is held to.
+ * ---------------------------------------------------------------------- */
+
+static int _ref_build_request_basis(uint8_t unit, uint8_t function, uint16_t addr, uint16_t nb, uint8_t *req){
+  req[0] = unit;
+  req[1] = function;
+  req[2] = addr >> 8;
+  req[3] = addr & 0x00ff;
+  req[4] = nb >> 8;
+  req[5] = nb & 0x00ff;
+
+  return _MODBUS_RTU_PRESET_REQ_LENGTH;
+}
+
+static uint16_t _ref_calc_CRC(uint8_t buf[], uint8_t len){
+  unsigned int crc, flag;
+  crc = 0xFFFF;
+  for(uint8_t i = 0; i < len; i++)
+  {
+    crc = crc ^ buf[i];
+    for(uint8_t j = 1; j <= 8; j++)
+    {
+      flag = crc & 0x0001;
+      crc >>=1;
+      if (flag)
+        crc ^= 0xA001;
+    }
+  }
+  return crc;
+}
+
+static int _ref_CRC_concatenate(uint8_t buf[], uint8_t len){
+  unsigned int temp;
+  temp = _ref_calc_CRC(buf, len);
+  buf[len]    = temp & 0x00FF;    // CRC-Lo
+  buf[len+1]  = temp >> 8;        // CRC-Hi
+
+  return len+2;
+}
+
+static int _ref_write_bits_gen(uint8_t unit, uint16_t addr, uint8_t nb, const uint8_t data[], uint8_t ADU[]){
+  int byte_count;
+  int len;
+  int bit_check = 0;
+  int pos = 0;
+
+  if (nb > MODBUS_MAX_WRITE_BITS) {
+    errno = EMBMDATA;
+    return -1;
+  }
+
+  len = _ref_build_request_basis(unit, MODBUS_FC_WRITE_MULTIPLE_COILS, addr, nb, ADU);
+  byte_count = (nb / 8) + ((nb % 8) ? 1 : 0);
+  ADU[len++] = byte_count;
+
+  for (int i=0; i<byte_count; i++) {
+    int bit;
+
+    bit = 0x01;
+    ADU[len] = 0;
+
+    while ((bit & 0xFF) && (bit_check++ < nb)) {
+      if (data[pos++])
+        ADU[len] |= bit;
+      else
+        ADU[len] &= ~bit;
+
+      bit = bit << 1;
+    }
+    len++;
+  }
+
+  len = _ref_CRC_concatenate(ADU, len);
+
+  return len;
+}
+
+static int _ref_ADU_parser(modbus_res_frame_t *frame){
+  unsigned int crc_expect = 0;
+  unsigned int crc_receive = 0;
+
+  frame->unit    = frame->ADU[0];
+  frame->fn_code = frame->ADU[1];
+
+  if(frame->fn_code & 0x80){
+    frame->ADU_len = 5;
+  }
+  else{
+    switch(frame->fn_code) {
+      case MODBUS_FC_READ_COILS:
+      case MODBUS_FC_READ_DISCRETE_INPUTS:
+      case MODBUS_FC_READ_HOLDING_REGISTERS:
+      case MODBUS_FC_READ_INPUT_REGISTERS:
+        frame->ADU_len = 2 + frame->ADU[2];
+        break;
+
+      case MODBUS_FC_WRITE_SINGLE_COIL:
+      case MODBUS_FC_WRITE_SINGLE_REGISTER:
+      case MODBUS_FC_WRITE_MULTIPLE_COILS:
+      case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+        frame->ADU_len = 5;
+        break;
+
+      default:;
+    }
+    frame->ADU_len += 3;
+  }
+
+  crc_expect = _ref_calc_CRC(frame->ADU, frame->ADU_len-2);
+  crc_receive = frame->ADU[frame->ADU_len-1]<<8 | frame->ADU[frame->ADU_len-2] ;
+  if(crc_expect != crc_receive){
+    errno = EMBBADCRC;
+    return -1;
+  }
+
+  if(frame->fn_code & 0x80){
+    errno = MODBUS_ENOBASE + frame->ADU[2];
+    return frame->ADU[2];
+  }
+
+  uint16_t *dest_reg = frame->data->registers;
+  uint8_t  *dest_bit = frame->data->bits;
+  uint8_t *rsp = frame->ADU;
+  int index_bits = 0;
+  int offset = 3;
+  int offset_end;
+  switch (frame->fn_code) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+      offset_end = frame->ADU_len-2;
+      for (int i=offset; i<offset_end; i++) {
+        for (int bit = 0x01; (bit & 0xff) && (index_bits < frame->num_reads);) {
+          dest_bit[index_bits++] = (rsp[i] & bit) ? TRUE : FALSE;
+          bit = bit << 1;
+        }
+      }
+      break;
+
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+      frame->num_reads = frame->ADU[2]/2;
+      for (int i=0; i < frame->num_reads; i++) {
+        dest_reg[i] = (rsp[3 + (i*2)] << 8) |
+                       rsp[4 + (i*2)];
+      }
+      break;
+
+    default:;
+  }
+
+  return 0;
+}
+
+/* CRC
+ * ---------------------------------------------------------------------- */
+
+static int _crc_case(uint8_t buf[], uint8_t len){
+  uint16_t expect = _ref_calc_CRC(buf, len);
+  uint16_t got = _calc_CRC(buf, len);
+
+  if (got == expect)
+    return 0;
+  fprintf(stderr, "MISMATCH crc, len %d: expect 0x%04X, got 0x%04X\n", len, expect, got);
+  _dump("input", buf, len);
+  return -1;
+}
+
+static int _crc_check(uint64_t iterations){
+  uint8_t buf[256];
+
+  // Every length, with the byte patterns that stress the shifts
+  for (int len = 0; len < 256; len++) {
+    static const uint8_t fills[] = { 0x00, 0xFF, 0x01, 0x80, 0xA5 };
+    for (size_t f = 0; f < sizeof(fills); f++) {
+      memset(buf, fills[f], sizeof(buf));
+      if (_crc_case(buf, len) == -1)
+        return -1;
+    }
+  }
+  for (uint64_t n = 0; n < iterations; n++) {
+    uint8_t len = _rand();
+    _rand_fill(buf, len);
+    if (_crc_case(buf, len) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/* modbus_write_bits_gen
+ * ---------------------------------------------------------------------- */
+
+static int _write_bits_case(uint8_t unit, uint16_t addr, uint8_t nb, const uint8_t data[]){
+  uint8_t expect[ARENA_SIZE], got[ARENA_SIZE];
+  int expect_rc, got_rc, expect_errno, got_errno;
+
+  // Same junk in both, so a stray write shows too
+  _rand_fill(expect, sizeof(expect));
+  memcpy(got, expect, sizeof(got));
+  errno = 0;
+  expect_rc = _ref_write_bits_gen(unit, addr, nb, data, expect);
+  expect_errno = errno;
+  errno = 0;
+  got_rc = modbus_write_bits_gen(unit, addr, nb, data, got);
+  got_errno = errno;
+
+  if (got_rc == expect_rc && (expect_rc != -1 || got_errno == expect_errno) &&
+      memcmp(got, expect, sizeof(got)) == 0)
+    return 0;
+  fprintf(stderr, "MISMATCH write_bits, unit %d addr %d nb %d: expect rc %d, got %d\n",
+          unit, addr, nb, expect_rc, got_rc);
+  _dump("data", data, nb);
+  _dump("expect", expect, expect_rc > 0 ? expect_rc : 16);
+  _dump("got", got, got_rc > 0 ? got_rc : 16);
+  return -1;
+}
+
+static int _write_bits_check(uint64_t iterations){
+  uint8_t data[256];
+
+  // Every nb, all clear, all set, alternating, then any non-zero as set
+  for (int nb = 0; nb < 256; nb++) {
+    for (int pattern = 0; pattern < 4; pattern++) {
+      for (int i = 0; i < nb; i++)
+        data[i] = pattern == 0 ? 0 : pattern == 1 ? 1 : pattern == 2 ? i & 1 : (uint8_t)_rand();
+      if (_write_bits_case(_rand(), _rand(), nb, data) == -1)
+        return -1;
+    }
+  }
+  for (uint64_t n = 0; n < iterations; n++) {
+    uint8_t nb = _rand();
+    for (int i = 0; i < nb; i++)
+      data[i] = _rand() & 1 ? (uint8_t)_rand() : 0;
+    if (_write_bits_case(_rand(), _rand(), nb, data) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/* modbus_ADU_parser
+ * ---------------------------------------------------------------------- */
+
+typedef struct parse_run_t {
+    modbus_res_frame_t frame;
+    modbus_res_data_t data;
+    uint8_t bits[256];
+    uint16_t registers[128];
+    int rc;
+    int err;
+} parse_run_t;
+
+static void _parse_run(parse_run_t *run, uint8_t *ADU, uint8_t num_reads, uint8_t ADU_len,
+                       int (*parser)(modbus_res_frame_t *)){
+  memset(run, 0, sizeof(*run));
+  memset(run->bits, 0xA5, sizeof(run->bits));
+  memset(run->registers, 0xA5, sizeof(run->registers));
+  run->data.bits = run->bits;
+  run->data.registers = run->registers;
+  run->frame.data = &run->data;
+  run->frame.ADU = ADU;
+  run->frame.num_reads = num_reads;
+  run->frame.ADU_len = ADU_len;   // what an unknown function code starts from
+  errno = 0;
+  run->rc = parser(&run->frame);
+  run->err = errno;
+}
+
+static int _parse_case(uint8_t *ADU, uint8_t num_reads){
+  parse_run_t expect, got;
+  uint8_t ADU_len = _rand();
+
+  _parse_run(&expect, ADU, num_reads, ADU_len, _ref_ADU_parser);
+  _parse_run(&got, ADU, num_reads, ADU_len, modbus_ADU_parser);
+  // The library now rejects an unknown function code before the CRC, the
+  // reference went on with whatever ADU_len the frame came with
+  switch (ADU[1] & 0x80 ? MODBUS_FC_READ_COILS : ADU[1]) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+      break;
+    default:
+      expect.rc = -1;
+      expect.err = EMBUNKFUN;
+      expect.frame.ADU_len = ADU_len;
+  }
+
+  if (got.rc == expect.rc && (expect.rc == 0 || got.err == expect.err) &&
+      got.frame.unit == expect.frame.unit && got.frame.fn_code == expect.frame.fn_code &&
+      got.frame.ADU_len == expect.frame.ADU_len && got.frame.num_reads == expect.frame.num_reads &&
+      got.frame.exception_code == expect.frame.exception_code &&
+      memcmp(got.bits, expect.bits, sizeof(got.bits)) == 0 &&
+      memcmp(got.registers, expect.registers, sizeof(got.registers)) == 0)
+    return 0;
+  fprintf(stderr, "MISMATCH parser, num_reads %d: expect rc %d errno %d ADU_len %d num_reads %d, "
+          "got rc %d errno %d ADU_len %d num_reads %d\n", num_reads,
+          expect.rc, expect.err, expect.frame.ADU_len, expect.frame.num_reads,
+          got.rc, got.err, got.frame.ADU_len, got.frame.num_reads);
+  _dump("ADU", ADU, 260);
+  return -1;
+}
+
+/* Builds a response: valid, exception, or random bytes, and returns the
+ * num_reads the master would have asked for.
+ */
+static uint8_t _parse_gen(uint8_t *ADU){
+  uint8_t num_reads = _rand();
+  int len;
+
+  _rand_fill(ADU, 512 - GUARD);
+  switch (_rand() % 5) {
+    case 0:   // read bits
+      ADU[1] = _rand() & 1 ? MODBUS_FC_READ_COILS : MODBUS_FC_READ_DISCRETE_INPUTS;
+      num_reads = 1 + _rand() % 255;
+      ADU[2] = (num_reads + 7) / 8;
+      len = 3 + ADU[2];
+      break;
+    case 1:   // read registers, the odd byte counts included
+      ADU[1] = _rand() & 1 ? MODBUS_FC_READ_HOLDING_REGISTERS : MODBUS_FC_READ_INPUT_REGISTERS;
+      ADU[2] = _rand() % (2 * MODBUS_MAX_READ_REGISTERS + 2);
+      len = 3 + ADU[2];
+      break;
+    case 2: { // write echo
+      static const uint8_t fn[] = { MODBUS_FC_WRITE_SINGLE_COIL, MODBUS_FC_WRITE_SINGLE_REGISTER,
+                                    MODBUS_FC_WRITE_MULTIPLE_COILS, MODBUS_FC_WRITE_MULTIPLE_REGISTERS };
+      ADU[1] = fn[_rand() % 4];
+      len = 6;
+      break;
+    }
+    case 3:   // exception
+      ADU[1] |= 0x80;
+      len = 3;
+      break;
+    default:  // any function code, any length
+      len = _rand() % 256;
+  }
+  _ref_CRC_concatenate(ADU, len);
+
+  // Corrupt some bits, or cut the frame short and leave junk in its place
+  switch (_rand() % 4) {
+    case 0:
+      for (int i = 1 + _rand() % 3; i > 0; i--)
+        ADU[_rand() % (len + 2)] ^= 1 << (_rand() % 8);
+      break;
+    case 1:
+      memset(&ADU[_rand() % (len + 2)], _rand() & 1 ? 0x00 : 0xFF, 1);
+      _rand_fill(&ADU[_rand() % (len + 2)], 2);
+      break;
+    default:;
+  }
+  return num_reads;
+}
+
+static int _parse_check(uint64_t iterations){
+  uint8_t arena[ARENA_SIZE];
+  uint8_t *ADU = &arena[GUARD];
+
+  _rand_fill(arena, sizeof(arena));
+  // Every function code with every byte count, CRC right where it says
+  for (int fn = 0; fn < 256; fn++) {
+    for (int count = 0; count < 256; count++) {
+      ADU[0] = _rand();
+      ADU[1] = fn;
+      ADU[2] = count;
+      _rand_fill(&ADU[3], count);
+      _ref_CRC_concatenate(ADU, 3 + count);
+      if (_parse_case(ADU, _rand()) == -1)
+        return -1;
+    }
+  }
+  for (uint64_t n = 0; n < iterations; n++) {
+    uint8_t num_reads = _parse_gen(ADU);
+    if (_parse_case(ADU, num_reads) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/* Array conversions against the per-value getters and setters
+ * ---------------------------------------------------------------------- */
+
+static float (*const _get_float[MODBUS_ORDER_MAX])(const uint16_t *) = {
+  [MODBUS_ORDER_ABCD] = modbus_get_float_abcd, [MODBUS_ORDER_DCBA] = modbus_get_float_dcba,
+  [MODBUS_ORDER_BADC] = modbus_get_float_badc, [MODBUS_ORDER_CDAB] = modbus_get_float_cdab
+};
+static void (*const _set_float[MODBUS_ORDER_MAX])(float, uint16_t *) = {
+  [MODBUS_ORDER_ABCD] = modbus_set_float_abcd, [MODBUS_ORDER_DCBA] = modbus_set_float_dcba,
+  [MODBUS_ORDER_BADC] = modbus_set_float_badc, [MODBUS_ORDER_CDAB] = modbus_set_float_cdab
+};
+
+#define _MAX_VALUES 67    // not a multiple of any vector width
+
+/* Converts nb values of type kind both ways, with the array function
+ * (fast) and one value at a time (expect)
+ */
+static void _convert_run(int kind, const uint16_t *regs, const void *values, int nb,
+                         modbus_byte_order_t order, int fast, void *got_values, uint16_t *got_regs){
+  switch (kind) {
+    case 0:
+      if (fast) {
+        modbus_get_float_array(regs, got_values, nb, order);
+        modbus_set_float_array(values, got_regs, nb, order);
+      }
+      else for (int i = 0; i < nb; i++) {
+        ((float *)got_values)[i] = _get_float[order](&regs[2 * i]);
+        _set_float[order](((const float *)values)[i], &got_regs[2 * i]);
+      }
+      break;
+    case 1:
+      if (fast) {
+        modbus_get_int32_array(regs, got_values, nb, order);
+        modbus_set_int32_array(values, got_regs, nb, order);
+      }
+      else for (int i = 0; i < nb; i++) {
+        ((int32_t *)got_values)[i] = modbus_get_int32(&regs[2 * i], order);
+        modbus_set_int32(((const int32_t *)values)[i], &got_regs[2 * i], order);
+      }
+      break;
+    case 2:
+      if (fast) {
+        modbus_get_uint32_array(regs, got_values, nb, order);
+        modbus_set_uint32_array(values, got_regs, nb, order);
+      }
+      else for (int i = 0; i < nb; i++) {
+        ((uint32_t *)got_values)[i] = modbus_get_uint32(&regs[2 * i], order);
+        modbus_set_uint32(((const uint32_t *)values)[i], &got_regs[2 * i], order);
+      }
+      break;
+    case 3:
+      if (fast) {
+        modbus_get_int64_array(regs, got_values, nb, order);
+        modbus_set_int64_array(values, got_regs, nb, order);
+      }
+      else for (int i = 0; i < nb; i++) {
+        ((int64_t *)got_values)[i] = modbus_get_int64(&regs[4 * i], order);
+        modbus_set_int64(((const int64_t *)values)[i], &got_regs[4 * i], order);
+      }
+      break;
+    default:
+      if (fast) {
+        modbus_get_double_array(regs, got_values, nb, order);
+        modbus_set_double_array(values, got_regs, nb, order);
+      }
+      else for (int i = 0; i < nb; i++) {
+        ((double *)got_values)[i] = modbus_get_double(&regs[4 * i], order);
+        modbus_set_double(((const double *)values)[i], &got_regs[4 * i], order);
+      }
+  }
+}
+
+static int _convert_check(uint64_t iterations){
+  static const char *names[] = { "float", "int32", "uint32", "int64", "double" };
+  // Room for a misaligned start, in registers and in values
+  uint16_t regs[4 * _MAX_VALUES + 4];
+  uint64_t values[_MAX_VALUES + 1];
+  uint64_t expect_values[_MAX_VALUES], got_values[_MAX_VALUES];
+  uint16_t expect_regs[4 * _MAX_VALUES], got_regs[4 * _MAX_VALUES];
+
+  for (uint64_t n = 0; n < iterations / 16 + 5 * MODBUS_ORDER_MAX * (_MAX_VALUES + 1); n++) {
+    // Sweep every kind, order and nb first, then pick at random
+    int sweep = n < 5 * MODBUS_ORDER_MAX * (_MAX_VALUES + 1);
+    int kind = sweep ? (int)(n % 5) : (int)(_rand() % 5);
+    modbus_byte_order_t order = sweep ? (n / 5) % MODBUS_ORDER_MAX : _rand() % MODBUS_ORDER_MAX;
+    int nb = sweep ? (int)(n / (5 * MODBUS_ORDER_MAX) % (_MAX_VALUES + 1)) : (int)(_rand() % (_MAX_VALUES + 1));
+    int words = kind < 3 ? 2 : 4;
+    const uint16_t *src = &regs[_rand() % 4];
+    size_t value_size = words * 2;
+
+    _rand_fill((uint8_t *)regs, sizeof(regs));
+    _rand_fill((uint8_t *)values, sizeof(values));
+    memset(expect_values, 0x5A, sizeof(expect_values));
+    memset(got_values, 0x5A, sizeof(got_values));
+    memset(expect_regs, 0x5A, sizeof(expect_regs));
+    memset(got_regs, 0x5A, sizeof(got_regs));
+
+    _convert_run(kind, src, values, nb, order, 0, expect_values, expect_regs);
+    _convert_run(kind, src, values, nb, order, 1, got_values, got_regs);
+
+    // Bit for bit, NaN payloads included
+    if (memcmp(got_values, expect_values, sizeof(got_values)) != 0 ||
+        memcmp(got_regs, expect_regs, sizeof(got_regs)) != 0) {
+      fprintf(stderr, "MISMATCH %s array, order %d nb %d\n", names[kind], order, nb);
+      _dump("regs", src, nb * value_size);
+      _dump("expect", expect_values, nb * value_size);
+      _dump("got", got_values, nb * value_size);
+      _dump("values", values, nb * value_size);
+      _dump("expect", expect_regs, nb * value_size);
+      _dump("got", got_regs, nb * value_size);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Throughput, reference against what the library runs
+ * ---------------------------------------------------------------------- */
+
+typedef struct bench_input_t {
+    uint8_t ADU[ARENA_SIZE];
+    uint8_t len;
+    uint8_t num_reads;
+} bench_input_t;
+
+static bench_input_t *pool;
+
+static void _bench_crc(int fast){
+  uint32_t acc = 0;
+  for (int i = 0; i < BENCH_POOL; i++)
+    acc += fast ? _calc_CRC(pool[i].ADU, pool[i].len) : _ref_calc_CRC(pool[i].ADU, pool[i].len);
+  sink += acc;
+}
+
+static void _bench_write_bits(int fast){
+  uint8_t ADU[ARENA_SIZE];
+  uint32_t acc = 0;
+  for (int i = 0; i < BENCH_POOL; i++) {
+    acc += fast ? modbus_write_bits_gen(1, 0, pool[i].len, pool[i].ADU, ADU)
+                : _ref_write_bits_gen(1, 0, pool[i].len, pool[i].ADU, ADU);
+    acc += ADU[7];
+  }
+  sink += acc;
+}
+
+static void _bench_parser(int fast){
+  uint8_t bits[256];
+  uint16_t registers[128];
+  modbus_res_data_t data = { bits, registers };
+  modbus_res_frame_t frame = { .data = &data };
+  uint32_t acc = 0;
+  for (int i = 0; i < BENCH_POOL; i++) {
+    frame.ADU = &pool[i].ADU[GUARD];
+    frame.num_reads = pool[i].num_reads;
+    acc += fast ? modbus_ADU_parser(&frame) : _ref_ADU_parser(&frame);
+    acc += registers[0];
+  }
+  sink += acc;
+}
+
+static void _bench_convert(int fast){
+  static uint16_t regs[4 * _MAX_VALUES];
+  static double values[_MAX_VALUES];
+  static uint16_t out_regs[4 * _MAX_VALUES];
+  static double out_values[_MAX_VALUES];
+  for (int i = 0; i < BENCH_POOL / 16; i++) {
+    for (int kind = 0; kind < 5; kind++)
+      _convert_run(kind, regs, values, _MAX_VALUES, i % MODBUS_ORDER_MAX, fast, out_values, out_regs);
+  }
+  sink += out_regs[0];
+}
+
+/* Best of a few runs, in ns per pass over the pool */
+static double _bench(void (*kernel)(int), int fast){
+  double best = 1e30;
+  for (int run = 0; run < 5; run++) {
+    uint64_t t0 = _now_ns();
+    for (int rep = 0; rep < 20; rep++)
+      kernel(fast);
+    double t = (_now_ns() - t0) / 20.0;
+    if (t < best)
+      best = t;
+  }
+  return best;
+}
+
+static void _bench_setup(void){
+  pool = malloc(BENCH_POOL * sizeof(*pool));
+  if (pool == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  for (int i = 0; i < BENCH_POOL; i++) {
+    // Mostly valid register and bit responses, as on a busy line
+    bench_input_t *in = &pool[i];
+    uint8_t *ADU = &in->ADU[GUARD];
+    _rand_fill(in->ADU, sizeof(in->ADU));
+    in->len = _rand();
+    ADU[0] = 1;
+    ADU[1] = 1 + _rand() % 4;
+    if (ADU[1] <= MODBUS_FC_READ_DISCRETE_INPUTS) {
+      in->num_reads = 1 + _rand() % 255;
+      ADU[2] = (in->num_reads + 7) / 8;
+    }
+    else {
+      in->num_reads = 0;
+      ADU[2] = 2 * (1 + _rand() % MODBUS_MAX_READ_REGISTERS);
+    }
+    _ref_CRC_concatenate(ADU, 3 + ADU[2]);
+  }
+}
+
+typedef struct kernel_t {
+    const char *name;
+    int (*check)(uint64_t iterations);
+    void (*bench)(int fast);
+} kernel_t;
+
+static const kernel_t kernels[] = {
+  { "crc",          _crc_check,        _bench_crc },
+  { "write_bits",   _write_bits_check, _bench_write_bits },
+  { "parser",       _parse_check,      _bench_parser },
+  { "convert",      _convert_check,    _bench_convert },
+};
+
+int main(int argc, char *argv[]){
+  uint64_t iterations = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterations = strtoull(optarg, NULL, 0);
+        break;
+      case 'r':
+        rng_state = strtoull(optarg, NULL, 0) | 1;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n iterations] [-r seed]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  _bench_setup();
+  printf("%-12s %10s %12s %12s %8s\n", "kernel", "result", "ref ns", "lib ns", "speedup");
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    double ref_ns, lib_ns;
+
+    if (kernels[k].check(iterations) == -1) {
+      printf("%-12s %10s\n", kernels[k].name, "MISMATCH");
+      return 1;
+    }
+    ref_ns = _bench(kernels[k].bench, 0);
+    lib_ns = _bench(kernels[k].bench, 1);
+    printf("%-12s %10s %12.0f %12.0f %7.2fx\n", kernels[k].name, "ok", ref_ns, lib_ns, ref_ns / lib_ns);
+  }
+  free(pool);
+  return 0;
+}
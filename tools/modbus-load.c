@@ -0,0 +1,522 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Load generator: a master built on the modbus_xxx_gen functions and
+ * modbus_ADU_parser, polling a farm of simulated slaves that answer with
+ * modbus_reply_gen. Reports throughput, outcomes and latency percentiles,
+ * and checks every value read against what the slave holds.
+ *
+ * Two links:
+ *   mem  frames are handed over in memory, in one thread. This measures
+ *        the stack itself: the slave latency is added to the measured time
+ *        instead of being slept.
+ *   pty  frames go through a pseudo terminal to a child process serving
+ *        the farm, which really waits for the slave latency.
+ *
+ * Build without diagnostics, or every injected error gets printed:
+ *   cc -O2 -DMODBUS_DEBUG=0 -Iinc tools/modbus-load.c src/modbus.c -o modbus-load
+ *
+ * Usage: modbus-load [-m mem|pty] [-n frames] [-t timeout_ms] [-r seed]
+ *                    [-S count:latency_us:exception_rate:crc_rate]...
+ *
+ * Each -S adds count slaves behaving alike, units are numbered from 1.
+ * Rates are probabilities per response: an exception replaces the answer
+ * with "slave busy", a CRC error flips one bit of it. Default farm is
+ * 16 slaves without latency nor errors.
+ */
+
+#define _GNU_SOURCE   // posix_openpt in test.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "modbus.h"
+#include "modbus-rtu-private.h"
+#include "../tests/test.h"    // test_pty_open, the pty the tests use
+
+#if !MODBUS_WITH_READ_BITS || !MODBUS_WITH_READ_REGISTERS || !MODBUS_WITH_WRITE || !MODBUS_WITH_SLAVE
+#error "modbus-load needs every function code and the slave side"
+#endif
+
+#define MAX_SLAVES    247
+#define TABLE_SIZE    1024      // registers and bits of each table of a slave
+#define DRAIN_MS      2         // silence that ends a garbled answer
+
+enum LOAD_FUNCS {
+  LOAD_READ_BITS = 0,
+  LOAD_READ_INPUT_BITS,
+  LOAD_READ_REGISTERS,
+  LOAD_READ_INPUT_REGISTERS,
+  LOAD_WRITE_BIT,
+  LOAD_WRITE_BITS,
+  LOAD_WRITE_REGISTER,
+  LOAD_WRITE_REGISTERS,
+  LOAD_FUNCS_MAX
+};
+
+typedef struct slave_t {
+  uint32_t latency_us;
+  double exception_rate;
+  double crc_rate;
+  modbus_mapping_t map;
+} slave_t;
+
+typedef struct load_stats_t {
+  uint64_t ok;
+  uint64_t exceptions;
+  uint64_t crc_errors;
+  uint64_t framing_errors;  // length of the answer not the one announced
+  uint64_t timeouts;
+  uint64_t mismatches;      // answer accepted but holding wrong values
+  uint64_t injected_exceptions;
+  uint64_t injected_crc;
+  uint64_t unexpected;      // outcome not the one injected, mem link only
+} load_stats_t;
+
+static slave_t farm[MAX_SLAVES];
+static int nb_slaves;
+static load_stats_t stats;
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t _rand(void){
+  // xorshift64*
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static int _chance(double p){
+  return p > 0 && (_rand() >> 11) * 0x1p-53 < p;
+}
+
+static uint64_t _now_ns(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Contents of the tables. Writes store the same pattern again, so the
+ * master can check any read whatever the order requests were served in.
+ */
+static uint16_t _reg_value(uint8_t unit, uint16_t addr){
+  return (uint16_t)(unit * 0x9E37u ^ addr * 0x2F1Bu);
+}
+
+static uint8_t _bit_value(uint8_t unit, uint16_t addr){
+  return (_reg_value(unit, addr) >> 7) & 0x01;
+}
+
+static int _farm_add(int count, uint32_t latency_us, double exception_rate, double crc_rate){
+  for (int i = 0; i < count; i++) {
+    slave_t *s;
+    uint8_t unit;
+
+    if (nb_slaves == MAX_SLAVES) {
+      errno = ENOMEM;
+      return -1;
+    }
+    s = &farm[nb_slaves];
+    unit = nb_slaves + 1;
+    s->latency_us     = latency_us;
+    s->exception_rate = exception_rate;
+    s->crc_rate       = crc_rate;
+    s->map.nb_bits = s->map.nb_input_bits = TABLE_SIZE;
+    s->map.nb_registers = s->map.nb_input_registers = TABLE_SIZE;
+    s->map.tab_bits            = malloc(TABLE_SIZE);
+    s->map.tab_input_bits      = malloc(TABLE_SIZE);
+    s->map.tab_registers       = malloc(TABLE_SIZE * sizeof(uint16_t));
+    s->map.tab_input_registers = malloc(TABLE_SIZE * sizeof(uint16_t));
+    if (s->map.tab_bits == NULL || s->map.tab_input_bits == NULL ||
+        s->map.tab_registers == NULL || s->map.tab_input_registers == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    for (int addr = 0; addr < TABLE_SIZE; addr++) {
+      s->map.tab_bits[addr]            = _bit_value(unit, addr);
+      s->map.tab_input_bits[addr]      = !_bit_value(unit, addr);
+      s->map.tab_registers[addr]       = _reg_value(unit, addr);
+      s->map.tab_input_registers[addr] = ~_reg_value(unit, addr);
+    }
+    nb_slaves++;
+  }
+  return 0;
+}
+
+/* Builds a random request of the given kind, returns its length */
+static int _request_gen(uint8_t unit, int kind, uint16_t *addr, uint8_t *nb, uint8_t req[]){
+  uint8_t bits[255];
+  uint16_t regs[MODBUS_MAX_WRITE_REGISTERS];
+  int max;
+
+  switch (kind) {
+    case LOAD_READ_REGISTERS:
+    case LOAD_READ_INPUT_REGISTERS:
+      max = MODBUS_MAX_READ_REGISTERS;
+      break;
+    case LOAD_WRITE_REGISTERS:
+      max = MODBUS_MAX_WRITE_REGISTERS;
+      break;
+    case LOAD_WRITE_BIT:
+    case LOAD_WRITE_REGISTER:
+      max = 1;
+      break;
+    default:
+      max = 255;  // nb is 8 bits wide
+  }
+  *nb = 1 + _rand() % max;
+  *addr = _rand() % (TABLE_SIZE - *nb + 1);
+
+  switch (kind) {
+    case LOAD_READ_BITS:
+      return modbus_read_bits_gen(unit, *addr, *nb, req);
+    case LOAD_READ_INPUT_BITS:
+      return modbus_read_input_bits_gen(unit, *addr, *nb, req);
+    case LOAD_READ_REGISTERS:
+      return modbus_read_registers_gen(unit, *addr, *nb, req);
+    case LOAD_READ_INPUT_REGISTERS:
+      return modbus_read_input_registers_gen(unit, *addr, *nb, req);
+    case LOAD_WRITE_BIT:
+      return modbus_write_bit_gen(unit, *addr, _bit_value(unit, *addr), req);
+    case LOAD_WRITE_BITS:
+      for (int i = 0; i < *nb; i++)
+        bits[i] = _bit_value(unit, *addr + i);
+      return modbus_write_bits_gen(unit, *addr, *nb, bits, req);
+    case LOAD_WRITE_REGISTER:
+      return modbus_write_register_gen(unit, *addr, _reg_value(unit, *addr), req);
+    default:
+      for (int i = 0; i < *nb; i++)
+        regs[i] = _reg_value(unit, *addr + i);
+      return modbus_write_registers_gen(unit, *addr, *nb, regs, req);
+  }
+}
+
+/* The farm: answers a request as the addressed slave, errors included.
+ * Returns the length of the answer, 0 if nobody answers.
+ */
+static int _farm_serve(const uint8_t req[], int req_len, uint8_t rsp[], uint32_t *latency_us){
+  slave_t *s;
+  int len;
+
+  *latency_us = 0;
+  if (req[0] == MODBUS_BROADCAST_ADDRESS || req[0] > nb_slaves)
+    return 0;
+  s = &farm[req[0] - 1];
+  *latency_us = s->latency_us;
+
+  if (_chance(s->exception_rate)) {
+    rsp[0] = req[0];
+    rsp[1] = req[1] | 0x80;
+    rsp[2] = MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY;
+    len = _CRC_concatenate(rsp, 3);
+    stats.injected_exceptions++;
+  }
+  else {
+    len = modbus_reply_gen(req, req_len, &s->map, rsp);
+  }
+  if (len > 0 && _chance(s->crc_rate)) {
+    rsp[_rand() % len] ^= 1 << (_rand() % 8);
+    stats.injected_crc++;
+  }
+  return len;
+}
+
+static void _farm_run(int fd){
+  uint8_t buf[512];
+  uint8_t rsp[MODBUS_MAX_ADU_LENGTH];
+  int len = 0;
+
+  for (;;) {
+    ssize_t n = read(fd, &buf[len], sizeof(buf) - len);
+    int req_len;
+
+    if (n <= 0)
+      _exit(n == 0 ? 0 : 1);
+    len += n;
+
+    while ((req_len = modbus_request_length(buf, len)) > 0 && req_len <= len) {
+      uint32_t latency_us;
+      int rsp_len = _farm_serve(buf, req_len, rsp, &latency_us);
+
+      if (latency_us)
+        nanosleep(&(struct timespec){ latency_us / 1000000, latency_us % 1000000 * 1000 }, NULL);
+      for (int sent = 0; sent < rsp_len;) {
+        n = write(fd, &rsp[sent], rsp_len - sent);
+        if (n <= 0)
+          _exit(1);
+        sent += n;
+      }
+      memmove(buf, &buf[req_len], len - req_len);
+      len -= req_len;
+    }
+  }
+}
+
+/* Throws away what is left of a garbled answer, up to a silence */
+static void _pty_drain(int fd){
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  uint8_t junk[256];
+
+  while (poll(&pfd, 1, DRAIN_MS) > 0) {
+    if (read(fd, junk, sizeof(junk)) <= 0)
+      return;
+  }
+}
+
+/* Sends a request and waits for the whole answer.
+ * Returns its length, 0 on timeout, -1 if it cannot be framed.
+ */
+static int _pty_exchange(int fd, const uint8_t req[], int req_len, uint8_t rsp[], int timeout_ms){
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  uint64_t deadline = _now_ns() + (uint64_t)timeout_ms * 1000000;
+  int len = 0;
+
+  for (int sent = 0; sent < req_len;) {
+    ssize_t n = write(fd, &req[sent], req_len - sent);
+    if (n <= 0)
+      return -1;
+    sent += n;
+  }
+
+  for (;;) {
+    int need = modbus_ADU_length(rsp, len);
+    uint64_t now;
+    ssize_t n;
+
+    if (need < 0)
+      return -1;
+    if (need > 0 && len >= need)
+      return need;
+
+    now = _now_ns();
+    if (now >= deadline || poll(&pfd, 1, (deadline - now + 999999) / 1000000) <= 0)
+      return 0;
+    // Never read past the answer, the next one must start clean
+    n = read(fd, &rsp[len], (need ? need : 3) - len);
+    if (n <= 0)
+      return -1;
+    len += n;
+  }
+}
+
+/* Checks the values read against the tables of the slave */
+static int _check(const modbus_res_frame_t *frame, int kind, uint16_t addr, uint8_t nb){
+  switch (kind) {
+    case LOAD_READ_BITS:
+    case LOAD_READ_INPUT_BITS:
+      for (int i = 0; i < nb; i++) {
+        uint8_t expect = _bit_value(frame->unit, addr + i);
+        if (frame->data->bits[i] != (kind == LOAD_READ_BITS ? expect : !expect))
+          return -1;
+      }
+      return 0;
+    case LOAD_READ_REGISTERS:
+    case LOAD_READ_INPUT_REGISTERS:
+      if (frame->num_reads != nb)
+        return -1;
+      for (int i = 0; i < nb; i++) {
+        uint16_t expect = _reg_value(frame->unit, addr + i);
+        if (frame->data->registers[i] != (kind == LOAD_READ_REGISTERS ? expect : (uint16_t)~expect))
+          return -1;
+      }
+      return 0;
+    default:
+      // Write answers echo the request
+      return (frame->ADU[2] << 8 | frame->ADU[3]) == addr ? 0 : -1;
+  }
+}
+
+static int _cmp_u64(const void *a, const void *b){
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void _usage(const char *prog){
+  fprintf(stderr, "Usage: %s [-m mem|pty] [-n frames] [-t timeout_ms] [-r seed]\n"
+                  "       [-S count:latency_us:exception_rate:crc_rate]...\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[]){
+  int use_pty = 0;
+  uint64_t nb_frames = 1000000;
+  int timeout_ms = 100;
+  int fd = -1;
+  pid_t child = -1;
+  uint64_t *latency_ns;
+  uint8_t req[MODBUS_MAX_ADU_LENGTH];
+  uint8_t rsp[512];
+  uint8_t bits_read[256];
+  uint16_t regs_read[MODBUS_MAX_READ_REGISTERS];
+  modbus_res_data_t data = { bits_read, regs_read };
+  modbus_res_frame_t frame;
+  uint64_t start, elapsed;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:n:t:r:S:")) != -1) {
+    switch (opt) {
+      case 'm':
+        if (strcmp(optarg, "pty") == 0)
+          use_pty = 1;
+        else if (strcmp(optarg, "mem") != 0)
+          _usage(argv[0]);
+        break;
+      case 'n':
+        nb_frames = strtoull(optarg, NULL, 0);
+        break;
+      case 't':
+        timeout_ms = atoi(optarg);
+        break;
+      case 'r':
+        rng_state = strtoull(optarg, NULL, 0) | 1;
+        break;
+      case 'S': {
+        int count;
+        unsigned int latency_us;
+        double exception_rate, crc_rate;
+        if (sscanf(optarg, "%d:%u:%lf:%lf", &count, &latency_us, &exception_rate, &crc_rate) != 4 ||
+            count < 1 || _farm_add(count, latency_us, exception_rate, crc_rate) == -1) {
+          fprintf(stderr, "Bad or too large farm: %s\n", optarg);
+          return 2;
+        }
+        break;
+      }
+      default:
+        _usage(argv[0]);
+    }
+  }
+  if (nb_frames == 0)
+    _usage(argv[0]);
+  if (nb_slaves == 0)
+    _farm_add(16, 0, 0, 0);
+
+  latency_ns = malloc(nb_frames * sizeof(uint64_t));
+  if (latency_ns == NULL) {
+    perror("malloc");
+    return 1;
+  }
+
+  if (use_pty) {
+    int slave_fd;
+
+    fd = test_pty_open(&slave_fd);
+    if (fd == -1)
+      return 1;
+
+    child = fork();
+    if (child == -1) {
+      perror("fork");
+      return 1;
+    }
+    if (child == 0) {
+      close(fd);
+      rng_state ^= 0xA5A5A5A5A5A5A5A5ULL;
+      _farm_run(slave_fd);
+    }
+    close(slave_fd);
+  }
+
+  frame.data = &data;
+  start = _now_ns();
+  for (uint64_t i = 0; i < nb_frames; i++) {
+    uint8_t unit = i % nb_slaves + 1;
+    int kind = _rand() % LOAD_FUNCS_MAX;
+    uint32_t slave_latency_us = 0;
+    uint64_t injected_exceptions = stats.injected_exceptions;
+    uint64_t injected_crc = stats.injected_crc;
+    uint16_t addr;
+    uint8_t nb;
+    int req_len, rsp_len, rc = 0;
+    uint64_t t0;
+
+    req_len = _request_gen(unit, kind, &addr, &nb, req);
+
+    t0 = _now_ns();
+    if (use_pty) {
+      rsp_len = _pty_exchange(fd, req, req_len, rsp, timeout_ms);
+    }
+    else {
+      rsp_len = _farm_serve(req, req_len, rsp, &slave_latency_us);
+      if (rsp_len > 0 && modbus_ADU_length(rsp, rsp_len) != rsp_len)
+        rsp_len = -1;
+    }
+
+    if (rsp_len > 0) {
+      frame.ADU = rsp;
+      frame.num_reads = nb;
+      rc = modbus_ADU_parser(&frame);
+    }
+    latency_ns[i] = _now_ns() - t0 + slave_latency_us * 1000ULL;
+
+    if (rsp_len == 0)
+      stats.timeouts++;
+    else if (rsp_len < 0)
+      stats.framing_errors++;
+    else if (rc == -1)
+      stats.crc_errors++;
+    else if (rc > 0)
+      stats.exceptions++;
+    else if (_check(&frame, kind, addr, nb) == -1)
+      stats.mismatches++;
+    else
+      stats.ok++;
+
+    if (!use_pty) {
+      int expect_error = stats.injected_crc != injected_crc;
+      int expect_exception = !expect_error && stats.injected_exceptions != injected_exceptions;
+      int got_error = rsp_len < 0 || (rsp_len > 0 && rc == -1);
+      int got_exception = rsp_len > 0 && rc > 0;
+      if (got_error != expect_error || got_exception != expect_exception)
+        stats.unexpected++;
+    }
+
+    if (use_pty && (rsp_len <= 0 || rc == -1))
+      _pty_drain(fd);
+  }
+  elapsed = _now_ns() - start;
+
+  if (use_pty) {
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+    close(fd);
+  }
+
+  qsort(latency_ns, nb_frames, sizeof(uint64_t), _cmp_u64);
+
+  printf("link            %s\n", use_pty ? "pty" : "mem");
+  printf("slaves          %d\n", nb_slaves);
+  printf("frames          %llu\n", (unsigned long long)nb_frames);
+  printf("elapsed         %.3f s\n", elapsed / 1e9);
+  printf("throughput      %.0f frames/s\n", nb_frames / (elapsed / 1e9));
+  printf("ok              %llu\n", (unsigned long long)stats.ok);
+  printf("exceptions      %llu\n", (unsigned long long)stats.exceptions);
+  printf("crc errors      %llu\n", (unsigned long long)stats.crc_errors);
+  printf("framing errors  %llu\n", (unsigned long long)stats.framing_errors);
+  printf("timeouts        %llu\n", (unsigned long long)stats.timeouts);
+  printf("mismatches      %llu\n", (unsigned long long)stats.mismatches);
+  if (!use_pty) {
+    printf("injected        %llu exceptions, %llu corrupted, %llu not caught as such\n",
+           (unsigned long long)stats.injected_exceptions, (unsigned long long)stats.injected_crc,
+           (unsigned long long)stats.unexpected);
+  }
+  printf("latency us      p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+         latency_ns[nb_frames * 50 / 100] / 1e3,
+         latency_ns[nb_frames * 90 / 100] / 1e3,
+         latency_ns[nb_frames * 99 / 100] / 1e3,
+         latency_ns[nb_frames * 999 / 1000] / 1e3,
+         latency_ns[nb_frames - 1] / 1e3);
+
+  free(latency_ns);
+
+  // Every injected error must be caught, and nothing else may go wrong
+  return stats.mismatches || stats.unexpected ? 1 : 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+#
+# Code and data size of the library for each build profile, see
+# inc/modbus-config.h. Cross builds go through the environment:
+#
+#   CC=arm-linux-gnueabihf-gcc SIZE=arm-linux-gnueabihf-size tools/size-report.sh
+#
+# A profile is a name, the sources linked in and the feature flags.
+# Sizes are the sum of the objects, in bytes.
+
+set -e
+
+CC=${CC:-cc}
+SIZE=${SIZE:-size}
+CFLAGS=${CFLAGS:--Os -std=gnu11}
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+MINIMAL="-DMODBUS_DEBUG=0 -DMODBUS_WITH_ERROR_STRINGS=0"
+
+profile() {
+  name=$1
+  sources=$2
+  flags=$3
+  objs=
+  for src in $sources; do
+    obj="$TMP/$name-${src%.c}.o"
+    $CC $CFLAGS $flags -I"$TOP/inc" -c "$TOP/src/$src" -o "$obj"
+    objs="$objs $obj"
+  done
+  $SIZE -t $objs | awk -v name="$name" 'END {
+    printf "%-18s %8d %8d %8d %8d\n", name, $1, $2, $3, $4 }'
+}
+
+printf "%-18s %8s %8s %8s %8s\n" profile text data bss total
+
+profile full \
+  "modbus.c modbus-data.c modbus-tag.c modbus-change.c modbus-series.c modbus-sched.c modbus-async.c modbus-image.c" ""
+profile core "modbus.c" ""
+profile core-minimal "modbus.c" "$MINIMAL"
+profile rtu-poller "modbus.c modbus-sched.c modbus-data.c" \
+  "$MINIMAL -DMODBUS_WITH_WRITE=0 -DMODBUS_WITH_SLAVE=0"
+profile register-reader "modbus.c" \
+  "$MINIMAL -DMODBUS_WITH_READ_BITS=0 -DMODBUS_WITH_WRITE=0 -DMODBUS_WITH_SLAVE=0"
+profile tcp-gateway "modbus.c modbus-async.c modbus-image.c" \
+  "$MINIMAL -DMODBUS_WITH_SLAVE=0"